@@ -0,0 +1,11 @@
+set -e
+# Build without the sanitizer, optimized, so the timings mean something:
+
+export Kokkos_ROOT=$HOME/src/kokkos/install
+cmake -DCMAKE_PREFIX_PATH=$Kokkos_ROOT -B build-release -DCMAKE_BUILD_TYPE=Release \
+    -DSIMPLE_TUNER_SANITIZE=OFF -DSIMPLE_TUNER_LOGGING=OFF
+cmake --build build-release --parallel
+
+# Run: ns per hook call, on one thread and on every core
+
+./build-release/src/tuner-overhead "$@"
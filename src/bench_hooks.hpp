@@ -0,0 +1,46 @@
+#pragma once
+
+/* The tuner's hooks, loaded from the library and called directly the way
+ * Kokkos calls them, for the benchmark drivers. */
+
+#include <Kokkos_Core.hpp>
+#include <dlfcn.h>
+#include <cstdio>
+
+#ifndef SIMPLE_TUNER_LIBRARY
+#define SIMPLE_TUNER_LIBRARY "libsimple-tuner.so"
+#endif
+
+struct TunerHooks {
+    void (*init)(const int, const uint64_t, const uint32_t, Kokkos_Profiling_KokkosPDeviceInfo*);
+    void (*finalize)(void);
+    void (*declareOutput)(const char*, const size_t, Kokkos_Tools_VariableInfo*);
+    void (*declareInput)(const char*, const size_t, Kokkos_Tools_VariableInfo*);
+    void (*begin)(const size_t);
+    void (*request)(const size_t, const size_t, const Kokkos_Tools_VariableValue*,
+        const size_t, Kokkos_Tools_VariableValue*);
+    void (*end)(const size_t);
+    /* not a Kokkos hook, see reportObjective() in tuning_playground.hpp */
+    void (*report)(const size_t, const char*, const double);
+    bool load(const char* path) {
+        void* library = dlopen(path, RTLD_NOW | RTLD_GLOBAL);
+        if (library == nullptr) {
+            fprintf(stderr, "Unable to load %s: %s\n", path, dlerror());
+            return false;
+        }
+        return find(library, "kokkosp_init_library", init) &&
+               find(library, "kokkosp_finalize_library", finalize) &&
+               find(library, "kokkosp_declare_output_type", declareOutput) &&
+               find(library, "kokkosp_declare_input_type", declareInput) &&
+               find(library, "kokkosp_begin_context", begin) &&
+               find(library, "kokkosp_request_values", request) &&
+               find(library, "kokkosp_end_context", end) &&
+               find(library, "simple_tuner_report_objective", report);
+    }
+    template <typename T>
+    static bool find(void* library, const char* name, T& function) {
+        function = reinterpret_cast<T>(dlsym(library, name));
+        if (function == nullptr) { fprintf(stderr, "No %s in the tuner\n", name); }
+        return function != nullptr;
+    }
+};
@@ -0,0 +1,133 @@
+/**
+ * mdrange-gemm
+ *
+ * A blocked matrix multiply C = A B over an MDRangePolicy on the rows and
+ * columns of C, run through tuned_kernel(). For every matrix size the tuner
+ * chooses the block (tile) size of each dimension, a static or dynamic
+ * schedule, and (on host backends) the number of threads.
+ *
+ * usage: mdrange-gemm [matrix size ...]    (default: 128 256)
+ */
+
+#include <Kokkos_Core.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include "tuning_playground.hpp"
+
+namespace KTE = Kokkos::Tools::Experimental;
+
+namespace gemm {
+    using View2D = Kokkos::View<double**, Kokkos::DefaultExecutionSpace::memory_space>;
+    /* the thread count is only tuned when the kernels run on the host */
+    constexpr bool tuneThreads{std::is_same<Kokkos::DefaultExecutionSpace,
+        Kokkos::DefaultHostExecutionSpace>::value};
+
+    /* one matrix size: the matrices, the instances for each thread count, and
+     * the context values tuned for it */
+    struct Matrices {
+        int64_t size;
+        View2D a;
+        View2D b;
+        View2D c;
+        std::map<int64_t, Kokkos::DefaultExecutionSpace> instances;
+        std::vector<KTE::VariableValue> inputs;
+        std::vector<KTE::VariableValue> outputs;
+    };
+
+    /* tiles of at most this many points: the most threads a GPU block can
+     * have, and 8 KB of doubles on the host */
+    constexpr double maxTilePoints{1024};
+
+    // the largest factor of size that is at most limit, as a starting tile
+    int64_t startingTile(int64_t size, int64_t limit) {
+        int64_t tile{1};
+        for (auto f : factorsOf(size)) { if (f <= limit) { tile = f; } }
+        return tile;
+    }
+
+    Matrices makeMatrices(int64_t size) {
+        Matrices m;
+        m.size = size;
+        m.a = View2D("gemm a", size, size);
+        m.b = View2D("gemm b", size, size);
+        m.c = View2D("gemm c", size, size);
+        auto a = m.a;
+        auto b = m.b;
+        Kokkos::parallel_for("gemm initialize",
+            Kokkos::MDRangePolicy<Kokkos::DefaultExecutionSpace, Kokkos::Rank<2>>({0, 0}, {size, size}),
+            KOKKOS_LAMBDA(const int64_t i, const int64_t j) {
+                a(i,j) = 1.0 / (1.0 + i + j);
+                b(i,j) = (i == j) ? 2.0 : 0.5 / (1.0 + i + j);
+            });
+        std::string suffix{" (" + std::to_string(size) + "^2)"};
+        size_t size_id = declareInputViewSize("gemm: matrix size", size);
+        m.inputs = {
+            KTE::make_variable_value(1, "mdrange gemm"),
+            KTE::make_variable_value(size_id, size)};
+        std::vector<size_t> tile_ids;
+        // the block sizes are factors of the matrix size
+        static const char* dims[] = {"row", "column"};
+        for (int d = 0 ; d < 2 ; d++) {
+            std::string name{std::string("gemm: ") + dims[d] + " block" + suffix};
+            size_t tile_id = declareOutputTileSize(name, name, size);
+            tile_ids.push_back(tile_id);
+            m.outputs.push_back(KTE::make_variable_value(tile_id, startingTile(size, d == 1 ? 32 : 4)));
+        }
+        constrainProduct(tile_ids, maxTilePoints);
+        size_t schedule_id = declareOutputSchedules("gemm: schedule" + suffix);
+        m.outputs.push_back(KTE::make_variable_value(schedule_id, int64_t(StaticSchedule)));
+        if (tuneThreads) {
+            size_t limit = Kokkos::DefaultExecutionSpace().concurrency();
+            size_t threads_id = declareOutputThreadCount("gemm: threads" + suffix, limit);
+            m.outputs.push_back(KTE::make_variable_value(threads_id, int64_t(std::max<size_t>(limit, 2) / 2 * 2)));
+            m.instances = threadCountInstances(limit);
+        }
+        return m;
+    }
+
+    void multiply(const Matrices& m) {
+        size_t context{KTE::get_new_context_id()};
+        KTE::begin_context(context);
+        std::vector<KTE::VariableValue> inputs{m.inputs};
+        KTE::set_input_values(context, inputs.size(), inputs.data());
+        std::vector<KTE::VariableValue> outputs{m.outputs};
+        KTE::request_output_values(context, outputs.size(), outputs.data());
+
+        Kokkos::DefaultExecutionSpace space{tuneThreads ?
+            m.instances.at(outputs[3].value.int_value) : Kokkos::DefaultExecutionSpace()};
+        const int64_t n{m.size};
+        auto a = m.a;
+        auto b = m.b;
+        auto c = m.c;
+        const auto kernel = KOKKOS_LAMBDA(const int64_t i, const int64_t j) {
+            double sum{0.0};
+            for (int64_t k = 0 ; k < n ; k++) {
+                sum += a(i,k) * b(k,j);
+            }
+            c(i,j) = sum;
+        };
+        parallelForTiled<2>("mdrange gemm", space, outputs[2].value.int_value,
+            {0, 0}, {n, n}, {outputs[0].value.int_value, outputs[1].value.int_value},
+            kernel);
+        // the kernel is part of the measurement, wherever it ran
+        space.fence();
+        KTE::end_context(context);
+    }
+};
+
+int main(int argc, char *argv[]) {
+    // before Kokkos::initialize moves its own arguments out of argv
+    std::vector<int64_t> sizes;
+    if (!sizesFromArguments(argc, argv, {128, 256}, sizes)) { return 1; }
+    tuned_kernel(argc, argv,
+        [&](const int /*total_iters*/) {
+            std::vector<gemm::Matrices> matrices;
+            for (auto size : sizes) { matrices.push_back(gemm::makeMatrices(size)); }
+            return std::make_tuple(matrices);
+        },
+        [&](const int x, const int /*total_iters*/, const std::vector<gemm::Matrices>& matrices) {
+            // the sizes take turns
+            gemm::multiply(matrices[x % matrices.size()]);
+        });
+}
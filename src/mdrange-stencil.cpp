@@ -0,0 +1,131 @@
+/**
+ * mdrange-stencil
+ *
+ * A 7 point stencil sweep over a 3D grid with an MDRangePolicy, run through
+ * tuned_kernel(). For every grid size the tuner chooses the tile size of each
+ * dimension, a static or dynamic schedule, and (on host backends) the number
+ * of threads, so the best tiling for each size shows up in the report.
+ *
+ * usage: mdrange-stencil [grid size ...]    (default: 64 128)
+ */
+
+#include <Kokkos_Core.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include "tuning_playground.hpp"
+
+namespace KTE = Kokkos::Tools::Experimental;
+
+namespace stencil {
+    using View3D = Kokkos::View<double***, Kokkos::DefaultExecutionSpace::memory_space>;
+    /* the thread count is only tuned when the kernels run on the host */
+    constexpr bool tuneThreads{std::is_same<Kokkos::DefaultExecutionSpace,
+        Kokkos::DefaultHostExecutionSpace>::value};
+
+    /* one grid size: the grids, the instances for each thread count, and the
+     * context values tuned for it */
+    struct Grid {
+        int64_t size;
+        View3D a;
+        View3D b;
+        std::map<int64_t, Kokkos::DefaultExecutionSpace> instances;
+        std::vector<KTE::VariableValue> inputs;
+        std::vector<KTE::VariableValue> outputs;
+    };
+
+    /* tiles of at most this many points: the most threads a GPU block can
+     * have, and 8 KB of doubles on the host */
+    constexpr double maxTilePoints{1024};
+
+    // the largest factor of size that is at most limit, as a starting tile
+    int64_t startingTile(int64_t size, int64_t limit) {
+        int64_t tile{1};
+        for (auto f : factorsOf(size)) { if (f <= limit) { tile = f; } }
+        return tile;
+    }
+
+    Grid makeGrid(int64_t size) {
+        Grid grid;
+        grid.size = size;
+        grid.a = View3D("stencil a", size, size, size);
+        grid.b = View3D("stencil b", size, size, size);
+        initArray(grid.a, size, size, size);
+        std::string suffix{" (" + std::to_string(size) + "^3)"};
+        size_t size_id = declareInputViewSize("stencil: grid size", size);
+        grid.inputs = {
+            KTE::make_variable_value(1, "mdrange stencil"),
+            KTE::make_variable_value(size_id, size)};
+        std::vector<size_t> tile_ids;
+        // the tile sizes are factors of the grid size
+        static const char* dims[] = {"i", "j", "k"};
+        for (int d = 0 ; d < 3 ; d++) {
+            std::string name{std::string("stencil: tile ") + dims[d] + suffix};
+            size_t tile_id = declareOutputTileSize(name, name, size);
+            tile_ids.push_back(tile_id);
+            grid.outputs.push_back(KTE::make_variable_value(tile_id, startingTile(size, d == 2 ? 32 : 4)));
+        }
+        constrainProduct(tile_ids, maxTilePoints);
+        size_t schedule_id = declareOutputSchedules("stencil: schedule" + suffix);
+        grid.outputs.push_back(KTE::make_variable_value(schedule_id, int64_t(StaticSchedule)));
+        if (tuneThreads) {
+            size_t limit = Kokkos::DefaultExecutionSpace().concurrency();
+            size_t threads_id = declareOutputThreadCount("stencil: threads" + suffix, limit);
+            grid.outputs.push_back(KTE::make_variable_value(threads_id, int64_t(std::max<size_t>(limit, 2) / 2 * 2)));
+            grid.instances = threadCountInstances(limit);
+        }
+        return grid;
+    }
+
+    /* one sweep from 'from' into 'to', copying the boundary */
+    void sweep(const Grid& grid, View3D from, View3D to) {
+        size_t context{KTE::get_new_context_id()};
+        KTE::begin_context(context);
+        std::vector<KTE::VariableValue> inputs{grid.inputs};
+        KTE::set_input_values(context, inputs.size(), inputs.data());
+        std::vector<KTE::VariableValue> outputs{grid.outputs};
+        KTE::request_output_values(context, outputs.size(), outputs.data());
+
+        Kokkos::DefaultExecutionSpace space{tuneThreads ?
+            grid.instances.at(outputs[4].value.int_value) : Kokkos::DefaultExecutionSpace()};
+        const int64_t n{grid.size};
+        const auto kernel = KOKKOS_LAMBDA(const int64_t i, const int64_t j, const int64_t k) {
+            if (i == 0 || j == 0 || k == 0 || i == n - 1 || j == n - 1 || k == n - 1) {
+                to(i,j,k) = from(i,j,k);
+                return;
+            }
+            to(i,j,k) = 0.4 * from(i,j,k) + 0.1 * (
+                from(i-1,j,k) + from(i+1,j,k) +
+                from(i,j-1,k) + from(i,j+1,k) +
+                from(i,j,k-1) + from(i,j,k+1));
+        };
+        parallelForTiled<3>("mdrange stencil", space, outputs[3].value.int_value,
+            {0, 0, 0}, {n, n, n},
+            {outputs[0].value.int_value, outputs[1].value.int_value, outputs[2].value.int_value},
+            kernel);
+        // the kernel is part of the measurement, wherever it ran
+        space.fence();
+        KTE::end_context(context);
+    }
+};
+
+int main(int argc, char *argv[]) {
+    // before Kokkos::initialize moves its own arguments out of argv
+    std::vector<int64_t> sizes;
+    if (!sizesFromArguments(argc, argv, {64, 128}, sizes)) { return 1; }
+    tuned_kernel(argc, argv,
+        [&](const int /*total_iters*/) {
+            std::vector<stencil::Grid> grids;
+            for (auto size : sizes) { grids.push_back(stencil::makeGrid(size)); }
+            return std::make_tuple(grids);
+        },
+        [&](const int x, const int /*total_iters*/, const std::vector<stencil::Grid>& grids) {
+            // the sizes take turns, and each one goes back and forth between its grids
+            const stencil::Grid& grid = grids[x % grids.size()];
+            if ((x / grids.size()) % 2 == 0) {
+                stencil::sweep(grid, grid.a, grid.b);
+            } else {
+                stencil::sweep(grid, grid.b, grid.a);
+            }
+        });
+}
@@ -10,12 +10,16 @@
 #include <random>
 #include <tuple>
 #include "tuning_playground.hpp"
+#include "smoothers.hpp"
 #include <chrono>
 #include <thread>
 
 namespace KTE = Kokkos::Tools::Experimental;
 
 namespace metasmoother {
+    /* the linear system every smoother solves, see smoothers.hpp */
+    smoothers::Problem* problem{nullptr};
+
     std::vector<KTE::VariableValue> makeChebychevVariables() {
         // output variable ids
         size_t out_variables[3];
@@ -35,7 +39,8 @@ namespace metasmoother {
         return answer_vector;
     }
 
-    size_t setupChebyshev(size_t context) {
+    /* set up and run the smoother, returns how many times it was applied */
+    int setupChebyshev(size_t context) {
         Kokkos::Profiling::ScopedRegion region("Chebyshev");
 
         // set the input values for the context - these two are always on the stack,
@@ -53,13 +58,11 @@ namespace metasmoother {
         // once the search has converged, you will get the same value for this context until exit.
         KTE::request_output_values(context, answer_vector.size(), answer_vector.data());
 
-        /* "run" the smoother. */
-        // try to converge on 5, 15, 75
-        size_t delay = 1 + (std::abs(5 - answer_vector[0].value.int_value) * 750) +
-                           (std::abs(15.0 - answer_vector[1].value.double_value) * 25) +
-                           (std::abs(75 - answer_vector[2].value.int_value) * 10);
-        // return the delay
-        return delay;
+        /* run the smoother: the solve checks the residual every "maximum iterations" applications */
+        int64_t degree = answer_vector[0].value.int_value;
+        double ratio = answer_vector[1].value.double_value;
+        int64_t iterations = answer_vector[2].value.int_value;
+        return problem->solve(iterations, [&]() { problem->chebyshev(degree, ratio); });
     }
 
     std::vector<KTE::VariableValue> makeMultiThreadedGaussSeidelVariables() {
@@ -78,7 +81,8 @@ namespace metasmoother {
         return answer_vector;
     }
 
-    size_t setupMultiThreadedGaussSeidel(size_t context) {
+    /* set up and run the smoother, returns how many times it was applied */
+    int setupMultiThreadedGaussSeidel(size_t context) {
         Kokkos::Profiling::ScopedRegion region("Multi-threaded Gauss-Seidel");
 
         // set the input values for the context - these two are always on the stack,
@@ -96,12 +100,10 @@ namespace metasmoother {
         // once the search has converged, you will get the same value for this context until exit.
         KTE::request_output_values(context, answer_vector.size(), answer_vector.data());
 
-        /* "run" the smoother. */
-        // try to converge on 1, 0.9
-        size_t delay = 1 + (std::abs(1 - answer_vector[0].value.int_value) * 100) +
-                           (std::abs(0.9 - answer_vector[1].value.double_value) * 100);
-        // return the delay
-        return delay;
+        /* run the smoother, checking the residual after every application */
+        int64_t sweeps = answer_vector[0].value.int_value;
+        double damping = answer_vector[1].value.double_value;
+        return problem->solve(1, [&]() { problem->multiThreadedGaussSeidel(sweeps, damping); });
     }
 
     std::vector<KTE::VariableValue> makeTwoStageGaussSeidelVariables() {
@@ -120,7 +122,8 @@ namespace metasmoother {
         return answer_vector;
     }
 
-    size_t setupTwoStageGaussSeidel(size_t context) {
+    /* set up and run the smoother, returns how many times it was applied */
+    int setupTwoStageGaussSeidel(size_t context) {
         Kokkos::Profiling::ScopedRegion region("Two-Stage Gauss-Seidel");
 
         // set the input values for the context - these two are always on the stack,
@@ -138,35 +141,28 @@ namespace metasmoother {
         // once the search has converged, you will get the same value for this context until exit.
         KTE::request_output_values(context, answer_vector.size(), answer_vector.data());
 
-        /* "run" the smoother. */
-        // try to converge on 2, 1.1
-        size_t delay = 1 + (std::abs(2 - answer_vector[0].value.int_value) * 100) +
-                           (std::abs(1.1 - answer_vector[1].value.double_value) * 100);
-        // return the delay
-        return delay;
+        /* run the smoother, checking the residual after every application */
+        int64_t sweeps = answer_vector[0].value.int_value;
+        double damping = answer_vector[1].value.double_value;
+        return problem->solve(1, [&]() { problem->twoStageGaussSeidel(sweeps, damping); });
     }
 };
 
 int main(int argc, char *argv[]) {
 
-    /* Report the "target" values - keeping in mind that the random search doesn't really converge */
-    std::string target(80, '-');
-    std::cout << "\nTarget values:\n" << target << std::endl;
-    std::cout << "Chebyshev: Degree target value: 5" << std::endl;
-    std::cout << "Chebyshev: Eigenvalue Ratio target value: 15" << std::endl;
-    std::cout << "Chebychev: Maximum Iterations target value: 75" << std::endl;
-    std::cout << "Multi-threaded Gauss-Seidel: Number of Sweeps target value: 1" << std::endl;
-    std::cout << "Multi-threaded Gauss-Seidel: Damping Factor target value: 0.9" << std::endl;
-    std::cout << "Two-Stage Gauss-Seidel: Number of Sweeps target value: 2" << std::endl;
-    std::cout << "Two-Stage Gauss-Seidel: Inner Damping Factor target value: 1.1" << std::endl;
-    std::cout << target << "\n" << std::endl;
-
     Kokkos::initialize(argc, argv);
+    /* the linear system: grid points per dimension, and 2 or 3 dimensions */
+    int n = argc > 1 ? atoi(argv[1]) : 64;
+    int dims = (argc > 2 && atoi(argv[2]) == 3) ? 3 : 2;
     /* 
      * This implementation uses explicit function calls to set up the search.
      */
     {
+        smoothers::Problem problem(n, dims);
+        metasmoother::problem = &problem;
         std::string banner(80, '=');
+        std::cout << "\nSolving a " << dims << "D Laplacian on " << n << "^" << dims
+                  << " points (" << problem.A.numRows << " rows)\n" << std::endl;
         std::cout << banner << "\nExplicit method:\n" << banner << std::endl;
 
         // lambda function to help us declare/setup the output variable once
@@ -183,6 +179,7 @@ int main(int argc, char *argv[]) {
             return answer_vector;
         };
 
+        size_t applications{0};
         /*
          * This outer loop represents the NOX main iteration...
          */
@@ -212,28 +209,24 @@ int main(int argc, char *argv[]) {
             size_t inner_context{KTE::get_new_context_id()};
             KTE::begin_context(inner_context);
 
-            // this is just a dummy value that we will use to "evalute" the output values.
-            // we will use it as a timer when "running" the rest of the NOX solve
-            size_t delay;
+            // the solve the parameters are evaluated on: it is the rest of the NOX iteration
             {
                 switch(answer_vector[0].value.int_value) {
                     case 0:
                         // set up parameters for a Chebyshev smoother
-                        delay = metasmoother::setupChebyshev(inner_context);
+                        applications += metasmoother::setupChebyshev(inner_context);
                         break;
                     case 1:
                         // set up parameters for a Multi-Threaded Gauss-Seidel smoother
-                        delay = metasmoother::setupMultiThreadedGaussSeidel(inner_context);
+                        applications += metasmoother::setupMultiThreadedGaussSeidel(inner_context);
                         break;
                     case 2:
                     default:
                         // set up parameters for a Two-Stage Gauss-Seidel smoother
-                        delay = metasmoother::setupTwoStageGaussSeidel(inner_context);
+                        applications += metasmoother::setupTwoStageGaussSeidel(inner_context);
                         break;
                 }
             }
-            // ...the assumption is that now we call the rest of the NOX code...
-            std::this_thread::sleep_for(std::chrono::microseconds(delay));
             // ... all of the NOX iteration should be captured by BOTH contexts, the inner and the outer.
             // that helps us evaluate the parameters for the smoother, and evaluate which smoother is the best.
 
@@ -243,7 +236,7 @@ int main(int argc, char *argv[]) {
             // end the outer context
             KTE::end_context(outer_context);
         }
-        std::cout << "done.\n" << banner << "\n" << std::endl;
+        std::cout << "done, " << applications << " smoother applications.\n" << banner << "\n" << std::endl;
     }
     Kokkos::finalize();
 }
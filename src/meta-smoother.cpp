@@ -9,13 +9,17 @@
 #include <cstdlib>
 #include <random>
 #include <tuple>
+#include <memory>
+#include <vector>
 #include "tuning_playground.hpp"
+#include "smoothers.hpp"
 #include <chrono>
 #include <thread>
 
 namespace KTE = Kokkos::Tools::Experimental;
 
 namespace metasmoother {
+
     std::vector<KTE::VariableValue> makeChebychevVariables() {
         // output variable ids
         size_t out_variables[3];
@@ -35,7 +39,14 @@ namespace metasmoother {
         return answer_vector;
     }
 
-    void doChebyshev(void) {
+    /* the output variables, declared the first time */
+    const std::vector<KTE::VariableValue>& chebyshevVariables() {
+        static const std::vector<KTE::VariableValue> variables{makeChebychevVariables()};
+        return variables;
+    }
+
+    /* solve the linear system (see smoothers.hpp) with this smoother */
+    void doChebyshev(smoothers::Problem& problem) {
         Kokkos::Profiling::ScopedRegion region("Chebyshev");
         // create a context
         size_t context{KTE::get_new_context_id()};
@@ -48,21 +59,20 @@ namespace metasmoother {
             KTE::make_variable_value(2, "parallel_for")};
         KTE::set_input_values(context, input_vector.size(), input_vector.data());
 
-        // set the output values for the context
-        static std::vector<KTE::VariableValue> answer_vector{makeChebychevVariables()};
+        // set the output values for the context, a copy for every call since
+        // the trials of a batch run at the same time
+        std::vector<KTE::VariableValue> answer_vector{chebyshevVariables()};
 
         // request new output values for the context
         // get the settings... this will increment the search in the search space and return a suggested value.
         // once the search has converged, you will get the same value for this context until exit.
         KTE::request_output_values(context, answer_vector.size(), answer_vector.data());
 
-        /* "run" the smoother. */
-        // try to converge on 5, 15, 75
-        size_t delay = 1 + (std::abs(5 - answer_vector[0].value.int_value) * 750) +
-                           (std::abs(15.0 - answer_vector[1].value.double_value) * 25) +
-                           (std::abs(75 - answer_vector[2].value.int_value) * 10);
-        // call the real solver - not really
-        std::this_thread::sleep_for(std::chrono::microseconds(delay));
+        /* run the smoother: the solve checks the residual every "maximum iterations" applications */
+        int64_t degree = answer_vector[0].value.int_value;
+        double ratio = answer_vector[1].value.double_value;
+        int64_t iterations = answer_vector[2].value.int_value;
+        problem.solve(iterations, [&]() { problem.chebyshev(degree, ratio); });
         // end the context - this will end timings for the context, and set the response value for this
         // context with those properties and those suggested values.
         KTE::end_context(context);
@@ -84,7 +94,14 @@ namespace metasmoother {
         return answer_vector;
     }
 
-    void MultiThreadedGaussSeidel(void) {
+    /* the output variables, declared the first time */
+    const std::vector<KTE::VariableValue>& multiThreadedGaussSeidelVariables() {
+        static const std::vector<KTE::VariableValue> variables{makeMultiThreadedGaussSeidelVariables()};
+        return variables;
+    }
+
+    /* solve the linear system (see smoothers.hpp) with this smoother */
+    void MultiThreadedGaussSeidel(smoothers::Problem& problem) {
         Kokkos::Profiling::ScopedRegion region("Multi-threaded Gauss-Seidel");
         // create a context
         size_t context{KTE::get_new_context_id()};
@@ -97,20 +114,19 @@ namespace metasmoother {
             KTE::make_variable_value(2, "parallel_for")};
         KTE::set_input_values(context, input_vector.size(), input_vector.data());
 
-        // set the output values for the context
-        static std::vector<KTE::VariableValue> answer_vector{makeMultiThreadedGaussSeidelVariables()};
+        // set the output values for the context, a copy for every call since
+        // the trials of a batch run at the same time
+        std::vector<KTE::VariableValue> answer_vector{multiThreadedGaussSeidelVariables()};
 
         // request new output values for the context
         // get the settings... this will increment the search in the search space and return a suggested value.
         // once the search has converged, you will get the same value for this context until exit.
         KTE::request_output_values(context, answer_vector.size(), answer_vector.data());
 
-        /* "run" the smoother. */
-        // try to converge on 1, 0.9
-        size_t delay = 1 + (std::abs(1 - answer_vector[0].value.int_value) * 100) +
-                           (std::abs(0.9 - answer_vector[1].value.double_value) * 100);
-        // call the real solver - not really
-        std::this_thread::sleep_for(std::chrono::microseconds(delay));
+        /* run the smoother, checking the residual after every application */
+        int64_t sweeps = answer_vector[0].value.int_value;
+        double damping = answer_vector[1].value.double_value;
+        problem.solve(1, [&]() { problem.multiThreadedGaussSeidel(sweeps, damping); });
         // end the context - this will end timings for the context, and set the response value for this
         // context with those properties and those suggested values.
         KTE::end_context(context);
@@ -132,7 +148,14 @@ namespace metasmoother {
         return answer_vector;
     }
 
-    void TwoStageGaussSeidel(void) {
+    /* the output variables, declared the first time */
+    const std::vector<KTE::VariableValue>& twoStageGaussSeidelVariables() {
+        static const std::vector<KTE::VariableValue> variables{makeTwoStageGaussSeidelVariables()};
+        return variables;
+    }
+
+    /* solve the linear system (see smoothers.hpp) with this smoother */
+    void TwoStageGaussSeidel(smoothers::Problem& problem) {
         Kokkos::Profiling::ScopedRegion region("Two-Stage Gauss-Seidel");
         // create a context
         size_t context{KTE::get_new_context_id()};
@@ -145,20 +168,19 @@ namespace metasmoother {
             KTE::make_variable_value(2, "parallel_for")};
         KTE::set_input_values(context, input_vector.size(), input_vector.data());
 
-        // set the output values for the context
-        static std::vector<KTE::VariableValue> answer_vector{makeTwoStageGaussSeidelVariables()};
+        // set the output values for the context, a copy for every call since
+        // the trials of a batch run at the same time
+        std::vector<KTE::VariableValue> answer_vector{twoStageGaussSeidelVariables()};
 
         // request new output values for the context
         // get the settings... this will increment the search in the search space and return a suggested value.
         // once the search has converged, you will get the same value for this context until exit.
         KTE::request_output_values(context, answer_vector.size(), answer_vector.data());
 
-        /* "run" the smoother. */
-        // try to converge on 2, 1.1
-        size_t delay = 1 + (std::abs(2 - answer_vector[0].value.int_value) * 100) +
-                           (std::abs(1.1 - answer_vector[1].value.double_value) * 100);
-        // call the real solver - not really
-        std::this_thread::sleep_for(std::chrono::microseconds(delay));
+        /* run the smoother, checking the residual after every application */
+        int64_t sweeps = answer_vector[0].value.int_value;
+        double damping = answer_vector[1].value.double_value;
+        problem.solve(1, [&]() { problem.twoStageGaussSeidel(sweeps, damping); });
         // end the context - this will end timings for the context, and set the response value for this
         // context with those properties and those suggested values.
         KTE::end_context(context);
@@ -167,36 +189,48 @@ namespace metasmoother {
 
 int main(int argc, char *argv[]) {
 
-    std::string target(80, '-');
-    std::cout << "\nTarget values:\n" << target << std::endl;
-    /* Report the "target" values - keeping in mind that the random search doesn't really converge */
-    std::cout << "Chebyshev: Degree target value: 5" << std::endl;
-    std::cout << "Chebyshev: Eigenvalue Ratio target value: 15" << std::endl;
-    std::cout << "Chebychev: Maximum Iterations target value: 75" << std::endl;
-    std::cout << "Multi-threaded Gauss-Seidel: Number of Sweeps target value: 1" << std::endl;
-    std::cout << "Multi-threaded Gauss-Seidel: Damping Factor target value: 0.9" << std::endl;
-    std::cout << "Two-Stage Gauss-Seidel: Number of Sweeps target value: 2" << std::endl;
-    std::cout << "Two-Stage Gauss-Seidel: Inner Damping Factor target value: 1.1" << std::endl;
-    std::cout << target << "\n" << std::endl;
-
     Kokkos::initialize(argc, argv);
+    /* the linear system: grid points per dimension, and 2 or 3 dimensions,
+     * and how many trials run at the same time */
+    int n = argc > 1 ? atoi(argv[1]) : 64;
+    int dims = (argc > 2 && atoi(argv[2]) == 3) ? 3 : 2;
+    int partitions = argc > 3 ? atoi(argv[3]) : 1;
     /* 
-     * This implementation uses the helper function fastest_of()
+     * This implementation uses the FastestOf handle from tuning_playground.hpp
      */
     {
+        /* BatchedTrials runs every trial of a batch on its own partition of
+           the device, and every partition solves its own copy of the system */
+        BatchedTrials batch(partitions);
+        std::vector<std::unique_ptr<smoothers::Problem>> problems;
+        for (size_t slot = 0 ; slot < batch.width() ; slot++) {
+            problems.emplace_back(new smoothers::Problem(n, dims, 1.0e-4, batch.instance(slot)));
+        }
         std::string banner(80, '=');
-        std::cout << "fastest_of() method:\n" << banner << std::endl;
+        std::cout << "\nSolving a " << dims << "D Laplacian on " << n << "^" << dims
+                  << " points (" << problems[0]->A.numRows << " rows), "
+                  << batch.width() << " at a time\n" << std::endl;
+        std::cout << "FastestOf method:\n" << banner << std::endl;
+        /* FastestOf sets up a search with name "meta-smoother" over 3
+           implementations once, and each call runs the one the tuner picks. */
+        // declare the variables before the trials run on several threads
+        metasmoother::chebyshevVariables();
+        metasmoother::multiThreadedGaussSeidelVariables();
+        metasmoother::twoStageGaussSeidelVariables();
+        FastestOf smoother("meta-smoother",
+            [&](smoothers::Problem& problem) { metasmoother::doChebyshev(problem); },
+            [&](smoothers::Problem& problem) { metasmoother::MultiThreadedGaussSeidel(problem); },
+            [&](smoothers::Problem& problem) { metasmoother::TwoStageGaussSeidel(problem); }
+        );
         Kokkos::Profiling::ScopedRegion region("meta smoother search loop");
-        for (int i = 0 ; i < 300 ; i++) {
-            /* fastest_of is a helper function that will set up a round-robin search
-               with name "meta-smoother" and 3 implementations to test. */
-            fastest_of("meta-smoother", 3,
-                [&]() { metasmoother::doChebyshev(); },
-                [&]() { metasmoother::MultiThreadedGaussSeidel(); },
-                [&]() { metasmoother::TwoStageGaussSeidel(); }
-            );
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0 ; i < 300 ; i += batch.width()) {
+            batch([&](const Kokkos::DefaultExecutionSpace&, size_t slot) {
+                smoother(*problems[slot]);
+            });
         }
-        std::cout << "done.\n" << banner << "\n" << std::endl;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "done in " << elapsed.count() << " s.\n" << banner << "\n" << std::endl;
     }
     Kokkos::finalize();
 }
@@ -19,16 +19,38 @@
 #include <sstream>
 #include <unordered_map>
 #include <mutex>
-#include <stack>
+#include <shared_mutex>
+#include <atomic>
 #include <vector>
 #include <set>
+#include <algorithm>
+#include <memory>
+#include <thread>
 #include <map>
+#include <deque>
 #include <iostream>
 #include <fstream>
 #include <random>
+#include <cmath>
 #include <stdlib.h>
+#include <stdint.h>
 #include <Kokkos_Core.hpp>
 #include "limits.h"
+#include "tuner_random.hpp"
+#include "tuner_bandit.hpp"
+#include "tuner_local_search.hpp"
+#include "tuner_cache.hpp"
+#include "tuner_space.hpp"
+#include "tuner_constraints.hpp"
+#include "tuner_trace.hpp"
+#include "tuner_telemetry.hpp"
+#include "tuner_stats.hpp"
+#include "tuner_bins.hpp"
+#include "tuner_async.hpp"
+#include "tuner_measure.hpp"
+#include "tuner_mpi.hpp"
+#include "tuner_model.hpp"
+#include "tuner_drift.hpp"
 
 #ifndef KOKKOS_ENABLE_TUNING
 #error "Error! Kokkos is not configured with tuning support. Please reconfigure and rebuild Kokkos with `-DKokkos_ENABLE_TUNING=ON`."
@@ -46,19 +68,249 @@ bool getVerbose() {
     return true;
 }
 
-class void_stream { 
+std::string getEnvString(const char* name, const std::string& fallback) {
+    char * tmp = getenv(name);
+    if (tmp == nullptr) { return fallback; }
+    return std::string(tmp);
+}
+
+double getEnvDouble(const char* name, double fallback) {
+    char * tmp = getenv(name);
+    if (tmp == nullptr) { return fallback; }
+    return atof(tmp);
+}
+
+/* How the values of an output variable are chosen */
+enum class StrategyType { Random, UCB1, Thompson, NelderMead, Coordinate, Halving };
+
+StrategyType parseStrategy(const std::string& name, StrategyType fallback) {
+    if (name == "random") { return StrategyType::Random; }
+    if (name == "ucb1") { return StrategyType::UCB1; }
+    if (name == "thompson") { return StrategyType::Thompson; }
+    if (name == "nelder-mead") { return StrategyType::NelderMead; }
+    if (name == "coordinate") { return StrategyType::Coordinate; }
+    if (name == "halving") { return StrategyType::Halving; }
+    std::cerr << "Unknown tuning strategy '" << name << "', ignoring" << std::endl;
+    return fallback;
+}
+
+std::string pST(StrategyType t) {
+    if (t == StrategyType::UCB1) { return std::string("ucb1"); }
+    if (t == StrategyType::Thompson) { return std::string("thompson"); }
+    if (t == StrategyType::NelderMead) { return std::string("nelder-mead"); }
+    if (t == StrategyType::Coordinate) { return std::string("coordinate"); }
+    if (t == StrategyType::Halving) { return std::string("halving"); }
+    return std::string("random");
+}
+
+/* Tuner options, read from the environment once:
+ *   KOKKOS_TUNING_STRATEGY         strategy for categorical sets: random,
+ *                                  ucb1, thompson or halving (default ucb1)
+ *   KOKKOS_TUNING_NUMERIC_STRATEGY strategy for ranges and ordinal sets:
+ *                                  random, nelder-mead or coordinate
+ *                                  (default nelder-mead)
+ *   KOKKOS_TUNING_STRATEGY_FOR     per variable overrides, as
+ *                                  "name=strategy;name=strategy"
+ *   KOKKOS_TUNING_HALVING_BUDGET   trials a halving search gets to narrow
+ *                                  the candidates down to one (default 0, 8
+ *                                  per candidate and round)
+ *   KOKKOS_TUNING_BANDIT_DISCOUNT  how much of the bandit history is kept
+ *                                  on every trial (default 0.995)
+ *   KOKKOS_TUNING_MAX_TRIALS       stop searching a signature after this
+ *                                  many trials, even if it hasn't converged
+ *                                  (default 0, no limit)
+ *   KOKKOS_TUNING_EXPLOIT_SAMPLING once a search has stopped, measure only
+ *                                  one in this many contexts (default 100,
+ *                                  0 to never measure)
+ *   KOKKOS_TUNING_CACHE            file to load results from at startup and
+ *                                  save them to at exit (default none)
+ *   KOKKOS_TUNING_SEED             seed for the random strategies, the same
+ *                                  seed gives the same sequence of trials
+ *   KOKKOS_TUNING_REPETITIONS      how many times a configuration is measured
+ *                                  before it can be compared (default 3)
+ *   KOKKOS_TUNING_STATISTIC        how those measurements are summarized:
+ *                                  median, trimmed-mean or mean (default median)
+ *   KOKKOS_TUNING_CONFIDENCE       how many standard errors faster than the
+ *                                  best so far a configuration has to be to
+ *                                  replace it (default 1.0)
+ *   KOKKOS_TUNING_BINS_PER_OCTAVE  how finely unbounded numeric inputs are
+ *                                  bucketed, buckets per factor of two
+ *                                  (default 4)
+ *   KOKKOS_TUNING_MAX_BINS         buckets on either side of zero (default
+ *                                  256), larger and smaller magnitudes go
+ *                                  into the outermost ones
+ *   KOKKOS_TUNING_OBJECTIVE        what a context measures: time, cycles,
+ *                                  instructions, cache-misses or energy
+ *                                  (default time), see tuner_measure.hpp
+ *   KOKKOS_TUNING_FENCE            1 to fence the device at the start and
+ *                                  end of every measurement, if Kokkos
+ *                                  provides a fence, except while batched
+ *                                  trials run (default 1)
+ *   KOKKOS_TUNING_OVERHEAD         what a measurement of nothing costs, in
+ *                                  the units of the objective, subtracted
+ *                                  from every measurement (default
+ *                                  calibrated at the first measurement, 0 to
+ *                                  subtract nothing)
+ *   KOKKOS_TUNING_OBJECTIVE_WEIGHTS weights for the objectives the application
+ *                                  reports with simple_tuner_report_objective,
+ *                                  as "name=weight;name=weight" (default 1),
+ *                                  "measured" is the weight of the measured
+ *                                  objective in those contexts (default 0)
+ *   KOKKOS_TUNING_ASYNC            1 to run the search strategies on a
+ *                                  background thread (default 0)
+ *   KOKKOS_TUNING_TRACE            file to write a binary trace of the hooks
+ *                                  to at exit (default none, no tracing)
+ *   KOKKOS_TUNING_TRACE_EVENTS     how many of the most recent events the
+ *                                  trace keeps (default 65536)
+ *   KOKKOS_TUNING_TELEMETRY        file to stream a row for every finished
+ *                                  context to (default none), see
+ *                                  tuner_telemetry.hpp
+ *   KOKKOS_TUNING_TELEMETRY_ROWS   rows in each of the two telemetry buffers
+ *                                  (default 16384)
+ *   KOKKOS_TUNING_MPI              with MPI support built in, 0 to tune every
+ *                                  rank on its own (default 1, share results)
+ *   KOKKOS_TUNING_MPI_INTERVAL     contexts between exchanges of results
+ *                                  between ranks (default 100)
+ *   KOKKOS_TUNING_DRIFT_THRESHOLD  how far (in standard deviations, summed
+ *                                  by CUSUM) the measurements of a stopped
+ *                                  search have to drift above what it
+ *                                  measured before it searches again
+ *                                  (default 8, 0 to never search again)
+ *   KOKKOS_TUNING_DRIFT_TOLERANCE  slowdown of a stopped search that isn't
+ *                                  a drift, as a fraction (default 0.1)
+ *   KOKKOS_TUNING_RETUNE_TRIALS    trials a search that drifted gets to find
+ *                                  a new best configuration (default 50)
+ *   KOKKOS_TUNING_MODEL            1 to start new searches from the best
+ *                                  configuration of the search with the
+ *                                  nearest sizes, see tuner_model.hpp
+ *                                  (default 0)
+ */
+class TunerOptions {
 public:
-    std::ostream& operator()(void) {
-        static bool verbose{getVerbose()};
-        static std::ofstream devNull("/dev/null");
-        if (verbose) {
-            return std::cout;
+    static TunerOptions& get(void) {
+        static TunerOptions options;
+        return options;
+    }
+    StrategyType categorical;
+    StrategyType numeric;
+    double banditDiscount;
+    size_t maxTrials;
+    size_t halvingBudget;
+    size_t exploitSampling;
+    std::string cachePath;
+    uint64_t seed;
+    size_t repetitions;
+    Statistic statistic;
+    double confidence;
+    size_t binsPerOctave;
+    size_t maxBins;
+    bool async;
+    Objective objective;
+    bool fence;
+    bool calibrate;
+    uint64_t overhead;
+    std::string tracePath;
+    size_t traceEvents;
+    std::string telemetryPath;
+    size_t telemetryRows;
+    bool mpi;
+    size_t mpiInterval;
+    bool model;
+    double driftThreshold;
+    double driftTolerance;
+    size_t retuneTrials;
+    std::map<std::string,StrategyType> perVariable;
+    std::map<std::string,double,std::less<>> objectiveWeights;
+    double measuredWeight;
+    /* how much a reported objective counts for */
+    double weightOf(const char* name) const {
+        auto iter = objectiveWeights.find(name);
+        return iter == objectiveWeights.end() ? 1.0 : iter->second;
+    }
+private:
+    TunerOptions() {
+        categorical = parseStrategy(
+            getEnvString("KOKKOS_TUNING_STRATEGY", "ucb1"), StrategyType::UCB1);
+        numeric = parseStrategy(
+            getEnvString("KOKKOS_TUNING_NUMERIC_STRATEGY", "nelder-mead"),
+            StrategyType::NelderMead);
+        banditDiscount = getEnvDouble("KOKKOS_TUNING_BANDIT_DISCOUNT", 0.995);
+        maxTrials = (size_t)getEnvDouble("KOKKOS_TUNING_MAX_TRIALS", 0);
+        halvingBudget = (size_t)getEnvDouble("KOKKOS_TUNING_HALVING_BUDGET", 0);
+        exploitSampling = (size_t)getEnvDouble("KOKKOS_TUNING_EXPLOIT_SAMPLING", 100);
+        cachePath = getEnvString("KOKKOS_TUNING_CACHE", "");
+        std::string seedString = getEnvString("KOKKOS_TUNING_SEED", "");
+        seed = seedString.empty() ? Xoshiro256::defaultSeed :
+            strtoull(seedString.c_str(), nullptr, 0);
+        repetitions = (size_t)getEnvDouble("KOKKOS_TUNING_REPETITIONS", 3);
+        if (repetitions == 0) { repetitions = 1; }
+        statistic = parseStatistic(getEnvString("KOKKOS_TUNING_STATISTIC", "median"));
+        confidence = getEnvDouble("KOKKOS_TUNING_CONFIDENCE", 1.0);
+        binsPerOctave = (size_t)getEnvDouble("KOKKOS_TUNING_BINS_PER_OCTAVE", 4);
+        maxBins = (size_t)getEnvDouble("KOKKOS_TUNING_MAX_BINS", 256);
+        async = getEnvDouble("KOKKOS_TUNING_ASYNC", 0) != 0;
+        objective = parseObjective(getEnvString("KOKKOS_TUNING_OBJECTIVE", "time"));
+        fence = getEnvDouble("KOKKOS_TUNING_FENCE", 1) != 0;
+        std::string overheadString = getEnvString("KOKKOS_TUNING_OVERHEAD", "");
+        calibrate = overheadString.empty();
+        overhead = calibrate ? 0 : strtoull(overheadString.c_str(), nullptr, 10);
+        tracePath = getEnvString("KOKKOS_TUNING_TRACE", "");
+        traceEvents = (size_t)getEnvDouble("KOKKOS_TUNING_TRACE_EVENTS", 65536);
+        telemetryPath = getEnvString("KOKKOS_TUNING_TELEMETRY", "");
+        telemetryRows = (size_t)getEnvDouble("KOKKOS_TUNING_TELEMETRY_ROWS", 16384);
+        mpi = getEnvDouble("KOKKOS_TUNING_MPI", 1) != 0;
+        mpiInterval = (size_t)getEnvDouble("KOKKOS_TUNING_MPI_INTERVAL", 100);
+        if (mpiInterval == 0) { mpiInterval = 1; }
+        model = getEnvDouble("KOKKOS_TUNING_MODEL", 0) != 0;
+        driftThreshold = getEnvDouble("KOKKOS_TUNING_DRIFT_THRESHOLD", 8.0);
+        driftTolerance = getEnvDouble("KOKKOS_TUNING_DRIFT_TOLERANCE", 0.1);
+        retuneTrials = (size_t)getEnvDouble("KOKKOS_TUNING_RETUNE_TRIALS", 50);
+        if (retuneTrials == 0) { retuneTrials = 1; }
+        std::stringstream overrides(getEnvString("KOKKOS_TUNING_STRATEGY_FOR", ""));
+        std::string item;
+        while (std::getline(overrides, item, ';')) {
+            size_t split = item.rfind('=');
+            if (split == std::string::npos) { continue; }
+            perVariable[item.substr(0, split)] = parseStrategy(
+                item.substr(split + 1), StrategyType::Random);
+        }
+        measuredWeight = 0.0;
+        std::stringstream weights(getEnvString("KOKKOS_TUNING_OBJECTIVE_WEIGHTS", ""));
+        while (std::getline(weights, item, ';')) {
+            size_t split = item.rfind('=');
+            if (split == std::string::npos) { continue; }
+            double weight = atof(item.c_str() + split + 1);
+            if (item.compare(0, split, "measured") == 0) {
+                measuredWeight = weight;
+            } else {
+                objectiveWeights[item.substr(0, split)] = weight;
+            }
         }
-        return devNull;
     }
 };
 
-void_stream mylog;
+/* Logging for KOKKOS_VERBOSE. Log with mylog() << ... as a statement: it
+ * expands to an if, so when logging is off none of the message is even
+ * evaluated. Building with SIMPLE_TUNER_DISABLE_LOGGING takes it out
+ * altogether. */
+class void_stream {
+public:
+    void_stream() : verbose_(getVerbose()) { }
+    bool enabled(void) const {
+#ifdef SIMPLE_TUNER_DISABLE_LOGGING
+        return false;
+#else
+        return verbose_;
+#endif
+    }
+    std::ostream& operator()(void) { return std::cout; }
+private:
+    const bool verbose_;
+};
+
+void_stream tunerLog;
+
+#define mylog() if (!tunerLog.enabled()) {} else tunerLog()
 
 std::string pVT(Kokkos_Tools_VariableInfo_ValueType t) {
     if (t == kokkos_value_double) {
@@ -143,50 +395,24 @@ std::string pCan(Kokkos_Tools_VariableInfo& i) {
     return std::string("unknown candidate values\n");
 }
 
-class Bin {
-public:
-    Bin(double value, size_t idx) :
-        mean((double)value),
-        total(value),
-        min(value),
-        max(value),
-        count(1) {
-        std::stringstream ss;
-        ss << "bin_" << idx;
-        name = ss.str();
-    }
-    double mean;
-    double total;
-    double min;
-    double max;
-    size_t count;
-    std::string name;
-    bool contains(double value) {
-        if (value <= max && value >= min) {
-            return true;
-        } else if (value <= (mean * 1.25) &&
-                   value >= (mean * 0.75)) {
-            return true;
-        }
-        return false;
-    }
-    void add(double value) {
-        count++;
-        total += value;
-        mean = (double)total / (double)count;
-        if (value < min) min = value;
-        if (value > max) max = value;
+/* FNV-1a, for hashes that have to be the same from run to run */
+uint64_t hashString(const char* str, size_t maxLength = SIZE_MAX) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0 ; i < maxLength && str[i] != '\0' ; i++) {
+        h = (h ^ (unsigned char)(str[i])) * 0x100000001b3ULL;
     }
-    std::string getName() {
-        return name;
-    }
-};
-
+    return h;
+}
 
+/* A declared variable. The members a request uses (the hash that goes in
+ * the signature, the strategy and the candidate space the strategies index
+ * into) come first so they share cache lines, and the metadata that is only
+ * read when a search is created or reported comes after them. The table
+ * allocates them together, see VariableTable. */
 class Variable {
 public:
     Variable(size_t _id, std::string _name, Kokkos_Tools_VariableInfo& _info, bool isOutput = true);
-    void reportBest(void);
+    std::string valueToString(const union Kokkos_Tools_VariableValue_ValueUnion& value);
     void deepCopy(Kokkos_Tools_VariableInfo& _info);
     std::string toString() {
         std::stringstream ss;
@@ -197,98 +423,67 @@ public:
         ss << "  info.category: " << pCat(info.category) << std::endl;
         ss << "  info.valueQuantity: " << pCVT(info.valueQuantity) << std::endl;
         ss << "  info.candidates: " << pCan(info);
-        if (info.valueQuantity == kokkos_value_unbounded) {
+        ss << "  strategy: " << pST(strategy) << std::endl;
+        if (binned()) {
             ss << "  num_bins: " << bins.size() << std::endl;
-            for (auto b : bins) {
-                ss << "  " << b->name << ": " << std::endl;
-                ss << "    min: " << std::fixed << b->min << std::endl;
-                ss << "    mean: " << std::fixed << b->mean << std::endl;
-                ss << "    max: " << std::fixed << b->max << std::endl;
-                ss << "    count: " << std::fixed << b->count << std::endl;
+            for (const auto& b : bins.snapshot()) {
+                ss << "  " << b.getName() << ": " << std::endl;
+                ss << "    min: " << std::fixed << b.min << std::endl;
+                ss << "    mean: " << std::fixed << b.mean() << std::endl;
+                ss << "    max: " << std::fixed << b.max << std::endl;
+                ss << "    count: " << std::fixed << b.count << std::endl;
             }
         }
         std::string tmp{ss.str()};
         return tmp;
     }
     size_t id;
+    uint64_t nameHash;
+    bool output;
+    StrategyType strategy;
+    /* the valid values of an output, the strategies work on indices into it */
+    CandidateSpace space;
     std::string name;
     std::string hashValue;
     Kokkos_Tools_VariableInfo info;
-    std::vector<std::string> space; // enum space
-    double dmin;
-    double dmax;
-    double dstep;
-    int64_t lmin;
-    int64_t lmax;
-    int64_t lstep;
-    int64_t lvar;
-    int64_t numValues;
     void makeSpace(void);
-    std::vector<Bin*> bins;
-    std::string getBin(double value) {
-        for (auto b : bins) {
-            if (b->contains(value)) {
-                b->add(value);
-                return b->getName();
-            }
-        }
-        Bin * b = new Bin(value, bins.size());
-        std::string tmp{b->getName()};
-        bins.push_back(b);
-        return tmp;
+    /* Unbounded numeric inputs with an order to them (sizes, ratios and
+     * so on) are bucketed, and the search key uses the bucket instead of
+     * the value. Categorical ones (ids, say) are used as they are. */
+    BinIndex bins;
+    bool binned(void) {
+        return !output && info.valueQuantity == kokkos_value_unbounded &&
+            info.category != kokkos_value_categorical &&
+            info.type != kokkos_value_string;
     }
-    size_t best_time;
-    union Kokkos_Tools_VariableValue_ValueUnion lastValue;
-    union Kokkos_Tools_VariableValue_ValueUnion bestValue;
-    bool output;
-    void assignNewValue(struct Kokkos_Tools_VariableValue& var) {
-        // what kind is it?
-        mylog() << "Setting " << name << " to ";
-        if (var.metadata->type == kokkos_value_double) {
-            var.value.double_value = newRandomDouble();
-            lastValue.double_value = var.value.double_value;
-            mylog() << var.value.double_value << std::endl;
-        }
-        else if (var.metadata->type == kokkos_value_int64) {
-            var.value.int_value = newRandomInt();
-            lastValue.int_value = var.value.int_value;
-            mylog() << var.value.int_value << std::endl;
-        }
-        else /* if (var.metadata->type == kokkos_value_string) */ {
-            strncpy(var.value.string_value, newRandomString().c_str(), KOKKOS_TOOLS_TUNING_STRING_LENGTH);
-            strncpy(lastValue.string_value, var.value.string_value, KOKKOS_TOOLS_TUNING_STRING_LENGTH);
-            mylog() << var.value.string_value << std::endl;
-        }
+    static double numericValue(Kokkos_Tools_VariableInfo_ValueType type,
+        const union Kokkos_Tools_VariableValue_ValueUnion& value) {
+        return type == kokkos_value_double ? value.double_value : (double)value.int_value;
     }
-    int64_t newRandomInt(void) {
-        size_t max = space.size();
-        size_t index = rand() % max;
-        return atol(space[index].c_str());
+    /* the key of the bin this value goes in */
+    int64_t getBin(const union Kokkos_Tools_VariableValue_ValueUnion& value) {
+        return bins.add(numericValue(info.type, value));
     }
-    double newRandomDouble(void) {
-        double r = ((double) rand() / (RAND_MAX));
-        double range = dmax - dmin;
-        double rando = dmin + (range * r);
-        return rando;
+    void chooseStrategy(void);
+    bool isSet(void) {
+        return info.valueQuantity == kokkos_value_set;
     }
-    std::string newRandomString(void) {
-        size_t max = space.size();
-        size_t index = rand() % max;
-        return space[index];
+    /* number of valid values, 0 for unbounded variables */
+    size_t numCandidates(void) {
+        return space.size();
     }
-    void updateBests(size_t duration) {
-        if (duration < best_time) {
-            best_time = duration;
-            if (info.type == kokkos_value_double) {
-                bestValue.double_value = lastValue.double_value;
-            }
-            else if (info.type == kokkos_value_int64) {
-                bestValue.int_value = lastValue.int_value;
-            }
-            else /* if (info.type == kokkos_value_string) */ {
-                strncpy(bestValue.string_value, lastValue.string_value, KOKKOS_TOOLS_TUNING_STRING_LENGTH);
-            }
-        }
+    /* assign value number 'index' from the candidate space */
+    void assignIndex(struct Kokkos_Tools_VariableValue& var, size_t index) {
+        space.assign(var.value, index);
+        mylog() << "Setting " << name << " to " << valueToString(var.value) << std::endl;
+    }
+    /* which candidate is this value? The nearest one for ranges, SIZE_MAX if
+     * it isn't in a set */
+    size_t indexOf(const union Kokkos_Tools_VariableValue_ValueUnion& value) {
+        return space.indexOf(value);
+    }
+    size_t randomIndex(void) {
+        return TunerRandom::get().below(space.size());
     }
 	~Variable() {
 	    if (info.category == kokkos_value_categorical ||
@@ -410,162 +605,1780 @@ void Variable::deepCopy(Kokkos_Tools_VariableInfo& _info) {
 
 Variable::Variable(size_t _id, std::string _name,
     Kokkos_Tools_VariableInfo& _info, bool isOutput) :
-        id(_id), name(_name), output(isOutput) {
+        id(_id), output(isOutput), strategy(StrategyType::Random), name(_name),
+        bins(TunerOptions::get().binsPerOctave, TunerOptions::get().maxBins) {
         deepCopy(_info);
-        // Create a hash object for strings
-        std::hash<std::string> hasher;
-        // Calculate the hash value of the string
-        hashValue = std::to_string(hasher(name));
+        // Hash the name, this has to be stable across runs (for the cache)
+        // so it can't be std::hash
+        nameHash = hashString(name.c_str());
+        hashValue = std::to_string(nameHash);
     /*
     if (KokkosSession::getSession().verbose) {
         mylog() << toString();
     }
     */
-    best_time = INT_MAX;
 }
 
-void Variable::reportBest(void) {
-    if (!output) return;
-    std::cout << "Best random value for variable " << name << ": ";
+/* Categorical sets get the categorical strategy (a bandit by default), and
+ * ordered things (ordinal sets and ranges) get the numeric strategy (a local
+ * search by default). Unbounded outputs can only be random. */
+void Variable::chooseStrategy(void) {
+    if (!output || numCandidates() == 0) { return; }
+    TunerOptions& options = TunerOptions::get();
+    auto iter = options.perVariable.find(name);
+    if (iter != options.perVariable.end()) {
+        strategy = iter->second;
+    } else if (isSet() && info.category == kokkos_value_categorical) {
+        strategy = options.categorical;
+    } else {
+        strategy = options.numeric;
+    }
+}
+
+std::string Variable::valueToString(
+    const union Kokkos_Tools_VariableValue_ValueUnion& value) {
+    std::stringstream ss;
     if (info.type == kokkos_value_double) {
-        std::cout << bestValue.double_value;
+        ss << value.double_value;
     }
     else if (info.type == kokkos_value_int64) {
-        std::cout << bestValue.int_value;
+        ss << value.int_value;
     }
     else /* if (info.type == kokkos_value_string) */ {
-        std::cout << bestValue.string_value;
+        ss << value.string_value;
     }
-    std::cout << std::endl;
+    std::string tmp{ss.str()};
+    return tmp;
 }
 
 void Variable::makeSpace(void) {
-    switch(info.category) {
-        case kokkos_value_categorical:
-        case kokkos_value_ordinal:
-        {
-            if (info.valueQuantity == kokkos_value_set) {
-                for (size_t index = 0 ; index < info.candidates.set.size ; index++) {
-                    if (info.type == kokkos_value_double) {
-                        std::string tmp = std::to_string(
-                                info.candidates.set.values.double_value[index]);
-                        space.push_back(tmp);
-                    } else if (info.type == kokkos_value_int64) {
-                        std::string tmp = std::to_string(
-                                info.candidates.set.values.int_value[index]);
-                        space.push_back(tmp);
-                    } else if (info.type == kokkos_value_string) {
-                        space.push_back(
-                            std::string(
-                                info.candidates.set.values.string_value[index]));
-                    }
+    space.build(info);
+}
+
+/* Variables are declared rarely (usually at startup) and looked up on every
+ * request. Kokkos numbers them from 0 up, so they go in a dense table
+ * indexed by id, made of chunks of slots that never move once they are
+ * allocated: a lookup is two loads and no lock. Ids past the end of the
+ * table go in a map under a reader/writer lock.
+ *
+ * The Variables themselves are allocated together in a deque (an arena
+ * that never moves them), instead of each one on its own somewhere in the
+ * heap, and are only freed at finalize. */
+class VariableTable {
+    private:
+    static constexpr size_t chunkSize{256};
+    static constexpr size_t numChunks{1024};
+    typedef std::atomic<Variable*> Slot;
+    std::atomic<Slot*> chunks_[numChunks];
+    std::mutex mutex_;
+    std::deque<Variable> arena_;
+    std::shared_mutex overflowMutex_;
+    std::map<size_t,Variable*> overflow_;
+    std::atomic<size_t> count_;
+    public:
+    VariableTable() : count_(0) {
+        for (auto& chunk : chunks_) { chunk.store(nullptr, std::memory_order_relaxed); }
+    }
+    ~VariableTable() { clear(); }
+    /* a new variable, which nobody can find until it is inserted */
+    Variable* allocate(size_t id, const char* name, Kokkos_Tools_VariableInfo& info,
+        bool isOutput) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        arena_.emplace_back(id, name, info, isOutput);
+        return &arena_.back();
+    }
+    void insert(size_t id, Variable* var) {
+        size_t chunk = id / chunkSize;
+        if (chunk >= numChunks) {
+            std::unique_lock<std::shared_mutex> guard(overflowMutex_);
+            if (overflow_.count(id) == 0) { count_++; }
+            overflow_[id] = var;
+            return;
+        }
+        std::lock_guard<std::mutex> guard(mutex_);
+        Slot* slots = chunks_[chunk].load(std::memory_order_relaxed);
+        if (slots == nullptr) {
+            slots = new Slot[chunkSize];
+            for (size_t i = 0 ; i < chunkSize ; i++) {
+                slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+            chunks_[chunk].store(slots, std::memory_order_release);
+        }
+        // a redeclaration replaces the old one (which stays in the arena)
+        if (slots[id % chunkSize].exchange(var, std::memory_order_release) == nullptr) {
+            count_++;
+        }
+    }
+    Variable* find(size_t id) {
+        size_t chunk = id / chunkSize;
+        if (chunk >= numChunks) {
+            std::shared_lock<std::shared_mutex> guard(overflowMutex_);
+            auto iter = overflow_.find(id);
+            return iter == overflow_.end() ? nullptr : iter->second;
+        }
+        Slot* slots = chunks_[chunk].load(std::memory_order_acquire);
+        if (slots == nullptr) { return nullptr; }
+        return slots[id % chunkSize].load(std::memory_order_acquire);
+    }
+    size_t size(void) const { return count_.load(); }
+    /* every variable ever declared, only safe when no hooks are running */
+    std::vector<Variable*> unsafeAll(void) {
+        std::vector<Variable*> all;
+        for (auto& var : arena_) { all.push_back(&var); }
+        return all;
+    }
+    /* only called from finalize, when no other hooks are running */
+    void clear(void) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (auto& chunk : chunks_) {
+            delete[] chunk.exchange(nullptr);
+        }
+        overflow_.clear();
+        arena_.clear();
+        count_.store(0);
+    }
+};
+
+VariableTable variables;
+
+/* A vector with inline storage for the first N elements. Contexts rarely
+ * have more than a handful of variables, so this keeps the id lists out of
+ * the heap. When it does spill, clear() keeps the capacity so a recycled
+ * context doesn't allocate again. */
+template<typename T, size_t N>
+class SmallVector {
+    private:
+    T inline_[N];
+    T* data_;
+    size_t size_;
+    size_t capacity_;
+    public:
+    SmallVector() : data_(inline_), size_(0), capacity_(N) { }
+    SmallVector(const SmallVector&) = delete;
+    SmallVector& operator=(const SmallVector&) = delete;
+    ~SmallVector() {
+        if (data_ != inline_) { delete[] data_; }
+    }
+    void push_back(const T& value) {
+        if (size_ == capacity_) {
+            T* tmp = new T[capacity_ * 2];
+            std::copy(data_, data_ + size_, tmp);
+            if (data_ != inline_) { delete[] data_; }
+            data_ = tmp;
+            capacity_ = capacity_ * 2;
+        }
+        data_[size_++] = value;
+    }
+    void clear(void) { size_ = 0; }
+    size_t size(void) const { return size_; }
+    T& operator[](size_t index) { return data_[index]; }
+    const T& operator[](size_t index) const { return data_[index]; }
+    T* begin(void) { return data_; }
+    T* end(void) { return data_ + size_; }
+};
+
+/* Mix a 64 bit value into a running hash (the splitmix64 finalizer) */
+inline uint64_t hashCombine(uint64_t hash, uint64_t value) {
+    uint64_t x = hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Find our Variable for a value. We hand Kokkos the Variable pointer as the
+ * toolProvidedInfo when it is declared, so usually this is free. */
+Variable* variableFor(const Kokkos_Tools_VariableValue& value) {
+    if (value.metadata != nullptr && value.metadata->toolProvidedInfo != nullptr) {
+        return static_cast<Variable*>(value.metadata->toolProvidedInfo);
+    }
+    return variables.find(value.type_id);
+}
+
+/* Hash one variable value, using the declared type to decide which part of
+ * the union is meaningful. Variables are identified by their name hash, not
+ * their id, so that the hash is the same in every run. */
+uint64_t hashVariableValue(uint64_t hash, const Kokkos_Tools_VariableValue& value) {
+    Variable* var = variableFor(value);
+    hash = hashCombine(hash, var != nullptr ? var->nameHash : value.type_id);
+    Kokkos_Tools_VariableInfo_ValueType type = kokkos_value_int64;
+    if (var != nullptr) {
+        type = var->info.type;
+    } else if (value.metadata != nullptr) {
+        type = value.metadata->type;
+    }
+    if (var != nullptr && var->binned()) {
+        return hashCombine(hash, (uint64_t)(var->getBin(value.value)));
+    }
+    if (type == kokkos_value_string) {
+        return hashCombine(hash, hashString(value.value.string_value,
+            KOKKOS_TOOLS_TUNING_STRING_LENGTH));
+    }
+    if (type == kokkos_value_double) {
+        uint64_t bits;
+        memcpy(&bits, &(value.value.double_value), sizeof(bits));
+        return hashCombine(hash, bits);
+    }
+    return hashCombine(hash, (uint64_t)(value.value.int_value));
+}
+
+/* The signature of a request is the set of input values it was made with,
+ * plus the output variables being tuned. Every distinct signature gets its
+ * own search. */
+uint64_t hashSignature(const size_t numContextVariables,
+    const Kokkos_Tools_VariableValue* contextVariableValues,
+    const size_t numTuningVariables,
+    const Kokkos_Tools_VariableValue* tuningVariableValues) {
+    uint64_t hash{0};
+    for (size_t i = 0 ; i < numContextVariables ; i++) {
+        hash = hashVariableValue(hash, contextVariableValues[i]);
+    }
+    // keep the inputs and outputs apart
+    hash = hashCombine(hash, numContextVariables);
+    // results in other units aren't comparable (time keeps the old keys)
+    if (Meter::objective() != Objective::Time) {
+        hash = hashCombine(hash, (uint64_t)Meter::objective());
+    }
+    for (size_t i = 0 ; i < numTuningVariables ; i++) {
+        Variable* var = variableFor(tuningVariableValues[i]);
+        hash = hashCombine(hash, var != nullptr ? var->nameHash : tuningVariableValues[i].type_id);
+    }
+    return hash;
+}
+
+/* The family of a search for the model: like the signature, but the
+ * numeric inputs with an order to them (sizes, ratios and so on) only count
+ * by name, and their values go into features instead. */
+uint64_t modelFamily(const size_t numContextVariables,
+    const Kokkos_Tools_VariableValue* contextVariableValues,
+    const size_t numTuningVariables,
+    const Kokkos_Tools_VariableValue* tuningVariableValues,
+    std::vector<double>& features) {
+    uint64_t hash{0};
+    for (size_t i = 0 ; i < numContextVariables ; i++) {
+        Variable* var = variableFor(contextVariableValues[i]);
+        if (var != nullptr && var->info.category != kokkos_value_categorical &&
+            var->info.type != kokkos_value_string) {
+            hash = hashCombine(hash, var->nameHash);
+            features.push_back(ConfigModel::feature(
+                Variable::numericValue(var->info.type, contextVariableValues[i].value)));
+        } else {
+            hash = hashVariableValue(hash, contextVariableValues[i]);
+        }
+    }
+    return hashCombine(hash, hashSignature(0, nullptr, numTuningVariables, tuningVariableValues));
+}
+
+/* Results from earlier runs, read at init and written at finalize. It isn't
+ * modified while the hooks are running. */
+TuningCache tuningCache;
+
+/* Constraints between output variables, declared by the application. */
+ConstraintTable constraintTable;
+
+/* The hook trace, only recording if KOKKOS_TUNING_TRACE is set. */
+TraceRing trace;
+
+/* Every finished context, only streamed if KOKKOS_TUNING_TELEMETRY is set. */
+TelemetryWriter telemetry;
+
+/* Results shared with the other MPI ranks, if there are any. */
+MpiExchange exchange;
+
+/* The best configurations by input sizes, for KOKKOS_TUNING_MODEL. */
+ConfigModel configModel;
+
+/* The search state for one signature. The best configuration is kept as the
+ * whole tuple of output values, so the answer reported at the end is a
+ * combination that was actually measured together.
+ *
+ * Every configuration tried gets its own SampleStats, and configurations
+ * are compared on their robust estimates once they have been measured
+ * KOKKOS_TUNING_REPETITIONS times. The best so far is only replaced by one
+ * that is faster by more than the noise.
+ *
+ * With other MPI ranks, every rank starts its bandits and its local search
+ * in a different part of the space, and a search only stops once the ranks
+ * have agreed on the best configuration, see adoptBest().
+ *
+ * With KOKKOS_TUNING_MODEL, a search that has nothing in the cache starts
+ * from the best configuration of the search with the nearest input sizes,
+ * and refines it with a smaller first step, see predictStart().
+ *
+ * A search that has stopped keeps an eye on the measurements of its best
+ * configuration, and if they drift slower it searches again around that
+ * configuration for KOKKOS_TUNING_RETUNE_TRIALS trials, see retune(). */
+class Search {
+    public:
+    Search(uint64_t signature, std::string description,
+        const size_t numContextVariables,
+        const Kokkos_Tools_VariableValue* contextVariableValues,
+        const size_t numTuningVariables,
+        const Kokkos_Tools_VariableValue* tuningVariableValues) :
+        _signature(signature), _description(description),
+        bestStats(nullptr), hasRandom(false),
+        trials(0), best_time(HUGE_VAL), exploiting_(false),
+        exploitTrials(0), exploitTotal(0.0), warmTrials(0),
+        drift(TunerOptions::get().driftThreshold, TunerOptions::get().driftTolerance),
+        nestedTrials(0), inclusiveTotal(0), exclusiveTotal(0) {
+        for (size_t i = 0 ; i < numTuningVariables ; i++) {
+            auto var = variables.find(tuningVariableValues[i].type_id);
+            outputs.push_back(var);
+            // until something is measured, the defaults are the best we have
+            bestValues.push_back(tuningVariableValues[i].value);
+            defaults.push_back(tuningVariableValues[i].value);
+            // categorical choices get their own bandit
+            if (var != nullptr && var->numCandidates() > 0 &&
+                (var->strategy == StrategyType::UCB1 ||
+                 var->strategy == StrategyType::Thompson ||
+                 var->strategy == StrategyType::Halving)) {
+                bandits.emplace_back(makeBandit(var, (size_t)exchange.rank()));
+            } else {
+                bandits.emplace_back(nullptr);
+                // ordered things go into one joint local search
+                if (var != nullptr && var->numCandidates() > 0 &&
+                    (var->strategy == StrategyType::NelderMead ||
+                     var->strategy == StrategyType::Coordinate)) {
+                    localDims.push_back(i);
+                } else if (var != nullptr && var->numCandidates() > 0) {
+                    hasRandom = true;
                 }
             }
-            break;
         }
-        case kokkos_value_interval:
-        case kokkos_value_ratio:
+        if (TunerOptions::get().model) {
+            family = modelFamily(numContextVariables, contextVariableValues,
+                numTuningVariables, tuningVariableValues, features);
+        }
+        bool converged = warmStart();
+        if (TunerOptions::get().model && warmTrials == 0) { predictStart(); }
+        std::vector<size_t> ids;
+        std::vector<const CandidateSpace*> spaces;
+        for (size_t i = 0 ; i < numTuningVariables ; i++) {
+            ids.push_back(tuningVariableValues[i].type_id);
+            spaces.push_back(outputs[i] == nullptr ? nullptr : &outputs[i]->space);
+        }
+        feasibleSpace.build(constraintTable.all(), ids, spaces);
+        if (!feasibleSpace.empty()) { feasibleStart(); }
+        if (!localDims.empty()) {
+            // a predicted start only needs refining
+            startLocal(predictedFrom.empty() ? 0.25 : refineSpread,
+                exchange.enabled() && warmTrials == 0 && predictedFrom.empty());
+        }
+        if (converged) {
+            // nothing left to learn, go straight to the fast path
+            startExploiting();
+        }
+    }
+    Bandit* makeBandit(Variable* var, size_t first) {
+        BanditPolicy policy = var->strategy == StrategyType::UCB1 ? BanditPolicy::UCB1 :
+            var->strategy == StrategyType::Halving ? BanditPolicy::Halving : BanditPolicy::Thompson;
+        return new Bandit(var->numCandidates(), policy,
+            TunerOptions::get().banditDiscount, first, TunerOptions::get().halvingBudget);
+    }
+    /* (Re)start the local search at the best configuration, with a first
+     * step of 'spread' of every dimension. The ranks start in different
+     * places if spreadRanks is set. */
+    void startLocal(double spread, bool spreadRanks) {
+        std::vector<size_t> levels;
+        std::vector<double> start;
+        for (auto i : localDims) {
+            size_t index = outputs[i]->indexOf(bestValues[i]);
+            // a default that isn't one of the candidates starts in the middle
+            size_t n = outputs[i]->numCandidates();
+            if (index == SIZE_MAX) { index = n / 2; }
+            if (spreadRanks) {
+                index = (index + (size_t)exchange.rank() * n / (size_t)exchange.size()) % n;
+            }
+            levels.push_back(outputs[i]->numCandidates());
+            start.push_back((double)index);
+        }
+        // the whole search uses the strategy of its first variable
+        if (outputs[localDims[0]]->strategy == StrategyType::Coordinate) {
+            local.reset(new CoordinateDescent(levels, start, spread));
+        } else {
+            local.reset(new NelderMead(levels, start, spread));
+        }
+        localPending = false;
+        localWorst = 0.0;
+    }
+    /* Start from the cached result for this signature, if there is one for
+     * the same outputs. Returns whether that search had converged. */
+    bool warmStart(void) {
+        const TuningCache::Record* record = tuningCache.find(_signature);
+        if (record == nullptr || record->outputs.size() != outputs.size()) {
+            return false;
+        }
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (outputs[i] == nullptr ||
+                record->outputs[i].nameHash != outputs[i]->nameHash) {
+                return false;
+            }
+        }
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            bestValues[i] = record->outputs[i].value;
+        }
+        best_time.store(record->header.bestCost, std::memory_order_relaxed);
+        warmTrials = record->header.trials;
+        publishBest();
+        return record->header.converged != 0;
+    }
+    /* Start from the best configuration of the nearest search of the same
+     * family: the bandits play its arms first, and the local search starts
+     * at its levels. */
+    void predictStart(void) {
+        std::vector<union Kokkos_Tools_VariableValue_ValueUnion> predicted;
+        std::string from;
+        if (!configModel.predict(family, features, predicted, from) ||
+            predicted.size() != outputs.size()) {
+            return;
+        }
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (outputs[i] == nullptr || outputs[i]->numCandidates() == 0) { continue; }
+            size_t index = outputs[i]->indexOf(predicted[i]);
+            if (index == SIZE_MAX) { continue; }
+            bestValues[i] = predicted[i];
+            if (bandits[i] != nullptr) { bandits[i]->startAt(index); }
+        }
+        predictedFrom = from;
+        mylog() << "Search for " << _description << " starts from the best of "
+                << from << std::endl;
+    }
+    /* the result of this search, for the tuning cache */
+    bool makeRecord(TuningCache::Record& record) {
+        if (trials.load() == 0 && warmTrials == 0) {
+            return false;
+        }
+        record.header.signature = _signature;
+        record.header.trials = warmTrials + trials.load();
+        record.header.bestCost = best_time.load();
+        record.header.numOutputs = (uint32_t)outputs.size();
+        record.header.converged = exploiting() ? 1 : 0;
+        record.outputs.resize(outputs.size());
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (outputs[i] == nullptr) { return false; }
+            record.outputs[i].nameHash = outputs[i]->nameHash;
+            record.outputs[i].value = bestValues[i];
+        }
+        return true;
+    }
+    uint64_t signature(void) const { return _signature; }
+    /* what the telemetry rows of this search hold */
+    void describeTelemetry(void) {
+        TelemetryWriter::Record record(TelemetryWriter::Kind::Search);
+        record.put(_signature);
+        record.put((uint32_t)outputs.size());
+        record.put(_description);
+        for (auto var : outputs) {
+            record.put((uint32_t)(var == nullptr ? kokkos_value_int64 : var->info.type));
+            record.put(var == nullptr ? std::string("unknown") : var->name);
+            uint32_t numStrings = (var != nullptr && var->info.type == kokkos_value_string) ?
+                (uint32_t)var->numCandidates() : 0;
+            record.put(numStrings);
+            for (uint32_t index = 0 ; index < numStrings ; index++) {
+                union Kokkos_Tools_VariableValue_ValueUnion value;
+                var->space.assign(value, index);
+                record.put(var->valueToString(value));
+            }
+        }
+        telemetry.describe(record);
+    }
+    /* an output value as it goes in a telemetry row */
+    uint64_t telemetryBits(size_t i, const union Kokkos_Tools_VariableValue_ValueUnion& value) {
+        if (outputs[i] != nullptr && outputs[i]->info.type == kokkos_value_string) {
+            size_t index = outputs[i]->indexOf(value);
+            return index == SIZE_MAX ? UINT64_MAX : (uint64_t)index;
+        }
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+    /* A configuration as candidate indices, for the background worker.
+     * Searches with more outputs than this are always done in the hooks. */
+    static constexpr size_t maxAsyncOutputs{8};
+    struct IndexTuple { size_t indices[maxAsyncOutputs]; };
+    bool asyncCapable(void) const { return outputs.size() <= maxAsyncOutputs; }
+    /* worker only: propose configurations ahead of time, until all the
+     * ready slots are full. Returns whether it proposed anything. */
+    bool refill(void) {
+        if (!asyncCapable() || exploiting()) { return false; }
+        bool filled{false};
+        size_t slot;
+        IndexTuple* tuple;
+        while ((tuple = ready.claim(slot)) != nullptr) {
+            if (scratch.empty()) {
+                scratch.resize(outputs.size());
+                for (size_t i = 0 ; i < outputs.size() ; i++) { scratch[i].value = defaults[i]; }
+            }
+            SmallVector<size_t,8> indices;
+            propose(scratch.data(), indices);
+            std::copy(indices.begin(), indices.end(), tuple->indices);
+            ready.publish(slot);
+            filled = true;
+        }
+        return filled;
+    }
+    /* take a configuration the worker proposed, if there is one ready */
+    bool takeProposal(Kokkos_Tools_VariableValue* tuningVariableValues,
+        SmallVector<size_t,8>& indices) {
+        IndexTuple tuple;
+        if (!ready.take(tuple)) { return false; }
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            indices.push_back(tuple.indices[i]);
+            if (tuple.indices[i] != SIZE_MAX) {
+                outputs[i]->assignIndex(tuningVariableValues[i], tuple.indices[i]);
+            }
+        }
+        return true;
+    }
+    /* Nothing ready, so hand out the best configuration so far, unless the
+     * worker is busy changing it (then the defaults have to do). */
+    void fallback(Kokkos_Tools_VariableValue* tuningVariableValues) {
+        std::unique_lock<std::mutex> guard(bestMutex, std::try_to_lock);
+        if (!guard.owns_lock()) { return; }
+        for (size_t i = 0 ; i < bestValues.size() ; i++) {
+            tuningVariableValues[i].value = bestValues[i];
+        }
+    }
+    /* a configuration that was handed out but won't be measured */
+    void abandon(const size_t* indices) {
+        std::lock_guard<std::mutex> guard(stateMutex);
+        for (size_t i = 0 ; i < bandits.size() ; i++) {
+            if (bandits[i] != nullptr) { bandits[i]->release(indices[i]); }
+        }
+    }
+    /* update() for a configuration given only as indices */
+    void updateIndices(double duration, const size_t* indices) {
+        SmallVector<union Kokkos_Tools_VariableValue_ValueUnion,8> values;
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            values.push_back(defaults[i]);
+            if (indices[i] != SIZE_MAX && outputs[i] != nullptr) {
+                outputs[i]->space.assign(values[i], indices[i]);
+            }
+        }
+        update(duration, values.begin(), indices);
+    }
+    /* The best configuration so far, for the other ranks. Returns false if
+     * there isn't one worth sharing. */
+    bool shareBest(MpiExchange::Record& record) {
+        if (outputs.size() > MpiExchange::maxOutputs) { return false; }
+        std::lock_guard<std::mutex> guard(bestMutex);
+        double cost = best_time.load(std::memory_order_relaxed);
+        if (cost == HUGE_VAL) { return false; }
+        record.signature = _signature;
+        record.cost = cost;
+        record.trials = trials.load(std::memory_order_relaxed);
+        // ranks that only get here later still hear what was agreed
+        record.converged = (exploiting() || localDone.load(std::memory_order_relaxed)) ? 1 : 0;
+        record.numOutputs = (uint32_t)outputs.size();
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            size_t index = (outputs[i] == nullptr || outputs[i]->numCandidates() == 0) ?
+                SIZE_MAX : outputs[i]->indexOf(bestValues[i]);
+            record.indices[i] = index == SIZE_MAX ? UINT32_MAX : (uint32_t)index;
+        }
+        return true;
+    }
+    /* The cheapest configuration any rank had in the last exchange. Every
+     * rank adopts the same one, and stops searching once any rank has
+     * nothing left to learn, or all the ranks together have used up the
+     * trial budget. */
+    void adoptBest(const MpiExchange::Record& record, uint64_t totalTrials, bool converged) {
+        if (record.numOutputs != outputs.size()) { return; }
+        std::lock_guard<std::mutex> state(stateMutex);
+        std::lock_guard<std::mutex> guard(bestMutex);
+        if (exploiting_.load(std::memory_order_relaxed)) { return; }
+        // a rank searching again after a drift finishes on its own
+        if (retunes > 0) { return; }
+        SmallVector<size_t,8> indices;
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            size_t index = record.indices[i] == UINT32_MAX ? SIZE_MAX : record.indices[i];
+            if (index != SIZE_MAX && outputs[i] != nullptr && index < outputs[i]->numCandidates()) {
+                outputs[i]->space.assign(bestValues[i], index);
+            }
+            indices.push_back(index);
+        }
+        bestStats = &configurations[configurationKey(indices.begin())];
+        best_time.store(record.cost, std::memory_order_relaxed);
+        publishBest();
+        size_t limit = TunerOptions::get().maxTrials;
+        if (converged || (limit > 0 && totalTrials >= limit)) {
+            mylog() << "Search for " << _description << " agreed after "
+                    << totalTrials << " trials on all ranks" << std::endl;
+            watch();
+            startExploiting();
+        }
+    }
+    void markReported(void) { reportedCost.store(true, std::memory_order_relaxed); }
+    /* the estimate for the best configuration, HUGE_VAL if there isn't one */
+    double bestTime(void) const { return best_time.load(std::memory_order_relaxed); }
+    /* for contexts with inner contexts */
+    void addNestedTimes(size_t inclusive, size_t exclusive) {
+        nestedTrials.fetch_add(1, std::memory_order_relaxed);
+        inclusiveTotal.fetch_add(inclusive, std::memory_order_relaxed);
+        exclusiveTotal.fetch_add(exclusive, std::memory_order_relaxed);
+    }
+    const std::string& description(void) const { return _description; }
+    size_t numOutputs(void) const { return outputs.size(); }
+    Variable* output(size_t index) { return outputs[index]; }
+    /* Once the search has converged (or run out of trials) it only hands out
+     * the best configuration, see exploit(). */
+    bool exploiting(void) const {
+        return exploiting_.load(std::memory_order_acquire);
+    }
+    /* the fast path: hands out the copy of the best configuration made
+     * when the search stopped, see startExploiting() */
+    void exploit(Kokkos_Tools_VariableValue* tuningVariableValues) {
+        const union Kokkos_Tools_VariableValue_ValueUnion* values =
+            exploitValues.load(std::memory_order_acquire);
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            tuningVariableValues[i].value = values[i];
+        }
+    }
+    /* the occasional measurement of the best configuration */
+    void updateExploit(double duration) {
+        std::lock_guard<std::mutex> guard(stateMutex);
+        exploitTrials++;
+        exploitTotal += duration;
+        if (bestStats != nullptr) { bestStats->add(duration); }
+        if (drift.add(duration)) { retune(); }
+    }
+    /* write the next configuration to try into tuningVariableValues, and
+     * the candidate index of each value (SIZE_MAX for unbounded outputs,
+     * which keep their default) into indices */
+    void propose(Kokkos_Tools_VariableValue* tuningVariableValues,
+        SmallVector<size_t,8>& indices) {
+        std::lock_guard<std::mutex> guard(stateMutex);
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            size_t index{SIZE_MAX};
+            if (bandits[i] != nullptr) {
+                index = bandits[i]->choose();
+                outputs[i]->assignIndex(tuningVariableValues[i], index);
+            } else if (outputs[i] != nullptr && !isLocal(i) &&
+                       outputs[i]->numCandidates() > 0) {
+                index = outputs[i]->randomIndex();
+                outputs[i]->assignIndex(tuningVariableValues[i], index);
+            }
+            indices.push_back(index);
+        }
+        if (local != nullptr) {
+            proposeLocal(tuningVariableValues, indices);
+        }
+        if (!feasibleSpace.empty()) {
+            makeFeasible(tuningVariableValues, indices);
+        }
+    }
+    /* credit a measurement (the cost of the context, lower is better) to
+     * the configuration that was handed out */
+    void update(double duration,
+        const union Kokkos_Tools_VariableValue_ValueUnion* values,
+        const size_t* indices) {
+        trials.fetch_add(1, std::memory_order_relaxed);
+        bool done;
         {
-            if (info.valueQuantity == kokkos_value_range) {
-                if (info.type == kokkos_value_double) {
-                    dstep = info.candidates.range.step.double_value;
-                    dmin = info.candidates.range.lower.double_value;
-                    dmax = info.candidates.range.upper.double_value;
-                    /*
-                     * [] and () denote whether the range is inclusive/exclusive of the endpoint:
-                     * [ includes the endpoint
-                     * ( excludes the endpoint
-                     * [] = 'Closed', includes both endpoints
-                     * () = 'Open', excludes both endpoints
-                     * [) and (] are both 'half-open', and include only one endpoint
-                     */
-                    if (info.candidates.range.openLower) {
-                        dmin = dmin + dstep;
-                    }
-                    if (info.candidates.range.openUpper) {
-                        dmax = dmax - dstep;
-                    }
-                } else if (info.type == kokkos_value_int64) {
-                    lstep = info.candidates.range.step.int_value;
-                    lmin = info.candidates.range.lower.int_value;
-                    lmax = info.candidates.range.upper.int_value;
-                    if (info.candidates.range.openLower) {
-                        lmin = lmin + lstep;
-                    }
-                    if (info.candidates.range.openUpper) {
-                        lmax = lmax - lstep;
-                    }
+            std::lock_guard<std::mutex> guard(stateMutex);
+            SampleStats& stats = configurations[configurationKey(indices)];
+            // one slow sample shouldn't tell the bandits an arm is slow
+            bool outlier = stats.isOutlier(duration);
+            stats.add(duration);
+            for (size_t i = 0 ; i < bandits.size() ; i++) {
+                if (bandits[i] == nullptr) { continue; }
+                if (outlier) {
+                    bandits[i]->release(indices[i]);
+                } else {
+                    bandits[i]->update(indices[i], duration);
                 }
             }
-            if (info.valueQuantity == kokkos_value_set) {
-                for (size_t index = 0 ; index < info.candidates.set.size ; index++) {
-                    if (info.type == kokkos_value_double) {
-                        std::string tmp = std::to_string(
-                                info.candidates.set.values.double_value[index]);
-                        space.push_back(tmp);
-                    } else if (info.type == kokkos_value_int64) {
-                        std::string tmp = std::to_string(
-                                info.candidates.set.values.int_value[index]);
-                        space.push_back(tmp);
-                    } else if (info.type == kokkos_value_string) {
-                        space.push_back(
-                            std::string(
-                                info.candidates.set.values.string_value[index]));
-                    }
+            if (local != nullptr) {
+                updateLocal(duration, indices);
+            }
+            // a context that was in flight when we stopped searching
+            if (exploiting_.load(std::memory_order_relaxed)) { return; }
+            updateBest(stats, values);
+            done = convergedLocked();
+        }
+        if (!done) { return; }
+        std::lock_guard<std::mutex> state(stateMutex);
+        std::lock_guard<std::mutex> guard(bestMutex);
+        if (exploiting_.load(std::memory_order_relaxed)) { return; }
+        adoptSurvivors();
+        if (exchange.enabled()) {
+            // keep going until the ranks agree on what the best is
+            localDone.store(true, std::memory_order_relaxed);
+            return;
+        }
+        mylog() << "Search for " << _description << " done after "
+                << trials.load() << " trials" << std::endl;
+        watch();
+        startExploiting();
+    }
+    void reportBest(void) {
+        std::cout << "Best configuration for " << _description
+                  << " (" << trials.load() << " trials";
+        if (warmTrials > 0) {
+            std::cout << ", " << warmTrials << " in earlier runs";
+        }
+        std::cout << "):" << std::endl;
+        if (!predictedFrom.empty()) {
+            std::cout << "    started from the best configuration of " << predictedFrom << std::endl;
+        }
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (outputs[i] == nullptr) { continue; }
+            std::cout << "  " << outputs[i]->name << ": "
+                      << outputs[i]->valueToString(bestValues[i]) << std::endl;
+            if (bandits[i] != nullptr && trials.load() > 0) {
+                reportBandit(i);
+            }
+        }
+        if (bestStats != nullptr) {
+            reportStats(*bestStats);
+        }
+        size_t nested = nestedTrials.load();
+        if (nested > 0) {
+            std::cout << "    with inner contexts, mean inclusive " << units() << ": "
+                      << inclusiveTotal.load() / nested << ", exclusive " << units() << ": "
+                      << exclusiveTotal.load() / nested << std::endl;
+        }
+        if (exploiting()) {
+            std::cout << "    searching stopped, " << exploitTrials
+                      << " measurements of the best configuration since";
+            if (exploitTrials > 0) {
+                std::cout << ", mean " << units() << ": " << shown(exploitTotal / (double)exploitTrials);
+            }
+            std::cout << std::endl;
+        }
+        if (retunes > 0) {
+            std::cout << "    searched again " << retunes << " times after the best configuration got slower"
+                      << std::endl;
+        }
+        if (local != nullptr && trials.load() > 0) {
+            std::cout << "    " << local->name() << " search over "
+                      << localDims.size() << " variables: " << local->evaluations()
+                      << " evaluations, " << localCache.size() << " distinct, "
+                      << (local->converged() ? "converged" : "not converged")
+                      << std::endl;
+        }
+    }
+    const char* units(void) const {
+        return reportedCost.load() ? "cost" : objectiveUnits(Meter::objective());
+    }
+    /* measurements are counts, reported costs needn't be */
+    std::string shown(double value) const {
+        std::stringstream ss;
+        if (reportedCost.load()) { ss << value; } else { ss << (size_t)value; }
+        return ss.str();
+    }
+    /* the measurements of the best configuration */
+    void reportStats(const SampleStats& stats) {
+        Statistic statistic = TunerOptions::get().statistic;
+        std::cout << "    measured " << stats.count() << " times, "
+                  << pStatistic(statistic) << " " << units() << ": " << shown(stats.estimate(statistic))
+                  << ", mean " << units() << ": " << shown(stats.mean())
+                  << ", sd " << units() << ": " << shown(stats.stddev())
+                  << ", outliers: " << stats.outliers() << std::endl;
+    }
+    /* how the trials were spread over the candidates */
+    void reportBandit(size_t i) {
+        std::cout << "    " << pST(outputs[i]->strategy) << " plays (discounted), mean "
+                  << units() << ":";
+        union Kokkos_Tools_VariableValue_ValueUnion candidate;
+        for (size_t arm = 0 ; arm < bandits[i]->numArms() ; arm++) {
+            outputs[i]->space.assign(candidate, arm);
+            std::cout << " [" << outputs[i]->valueToString(candidate) << ": "
+                      << bandits[i]->count(arm) << ", "
+                      << shown(bandits[i]->mean(arm));
+            if (bandits[i]->halving() && !bandits[i]->alive(arm)) { std::cout << ", dropped"; }
+            std::cout << "]";
+        }
+        std::cout << std::endl;
+        if (bandits[i]->halving()) {
+            std::cout << "    halving: " << std::min(bandits[i]->round(), bandits[i]->rounds())
+                      << " of " << bandits[i]->rounds() << " rounds done" << std::endl;
+        }
+    }
+    private:
+    uint64_t _signature;
+    std::string _description;
+    std::vector<Variable*> outputs;
+    /* protects the strategy state below */
+    std::mutex stateMutex;
+    std::vector<std::unique_ptr<Bandit>> bandits;
+    /* the outputs handled by the local search, and its state */
+    std::vector<size_t> localDims;
+    std::unique_ptr<LocalSearch> local;
+    /* the worst cost it has been told, what infeasible points are worse than */
+    double localWorst{0.0};
+    /* the levels that the local search is waiting to hear about */
+    std::vector<size_t> localPoint;
+    bool localPending;
+    /* measurements of configurations already tried, so that the local
+     * search doesn't spend trials on points that round to the same levels */
+    std::map<std::vector<size_t>,SampleStats> localCache;
+    /* the measurements of every full configuration, by configurationKey() */
+    std::unordered_map<uint64_t,SampleStats> configurations;
+    /* the entry for the best configuration, nullptr until one is chosen
+     * (or if it came from the cache) */
+    SampleStats* bestStats;
+    /* are any of the outputs sampled at random? */
+    bool hasRandom;
+    /* the constraints between the outputs, if any were declared */
+    FeasibleSpace feasibleSpace;
+    /* where the search is for the model, and the search it started from */
+    uint64_t family{0};
+    std::vector<double> features;
+    std::string predictedFrom;
+    /* the first step of a local search from a prediction, or one that is
+     * searching again, as a fraction of each dimension (the usual one is a
+     * quarter) */
+    static constexpr double refineSpread{0.1};
+    /* tell the model about the best configuration, with bestMutex held (or
+     * before the search is shared) */
+    void publishBest(void) {
+        if (!TunerOptions::get().model) { return; }
+        configModel.publish(family, this, features, bestValues.data(),
+            bestValues.size(), _description);
+    }
+    uint64_t configurationKey(const size_t* indices) {
+        uint64_t key{0};
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            key = hashCombine(key, indices[i]);
+        }
+        return key;
+    }
+    /* how many measurements a configuration needs before it is compared.
+     * Configurations with random values hardly ever come up twice, so
+     * those searches have to make do with one. */
+    size_t needed(void) {
+        return hasRandom ? 1 : TunerOptions::get().repetitions;
+    }
+    /* Is this configuration now the best one? It has to have enough
+     * measurements, and be faster than the best so far by more than
+     * 'confidence' standard errors of the difference. */
+    void updateBest(SampleStats& stats,
+        const union Kokkos_Tools_VariableValue_ValueUnion* values) {
+        if (stats.count() < needed()) { return; }
+        TunerOptions& options = TunerOptions::get();
+        double estimate = stats.estimate(options.statistic);
+        if (&stats == bestStats) {
+            // new measurements of the best, keep its estimate up to date
+            best_time.store(estimate, std::memory_order_relaxed);
+            return;
+        }
+        double incumbent = best_time.load(std::memory_order_relaxed);
+        double error = stats.standardError();
+        if (bestStats != nullptr) {
+            error = std::sqrt(error * error +
+                bestStats->standardError() * bestStats->standardError());
+        }
+        if (estimate + options.confidence * error >= incumbent) { return; }
+        std::lock_guard<std::mutex> guard(bestMutex);
+        bestStats = &stats;
+        best_time.store(estimate, std::memory_order_relaxed);
+        std::copy(values, values + bestValues.size(), bestValues.begin());
+        publishBest();
+    }
+    bool isLocal(size_t i) {
+        return std::find(localDims.begin(), localDims.end(), i) != localDims.end();
+    }
+    std::vector<size_t> levelsOf(const std::vector<double>& point) {
+        std::vector<size_t> levels(point.size());
+        for (size_t d = 0 ; d < point.size() ; d++) {
+            levels[d] = local->level(point, d);
+        }
+        return levels;
+    }
+    /* The local search is sequential, so it works on one point at a time:
+     * every context that asks gets that point until it has been measured
+     * enough times, and then the search hears its estimated cost. */
+    void proposeLocal(Kokkos_Tools_VariableValue* tuningVariableValues,
+        SmallVector<size_t,8>& indices) {
+        std::vector<size_t> levels;
+        if (!localPending) {
+            // answer from the cache until we get somewhere new
+            bool feasible{true};
+            for (size_t tries = 0 ; tries < 100 ; tries++) {
+                levels = levelsOf(local->ask());
+                if (local->converged()) { break; }
+                // points that break a constraint are never run, they just
+                // cost more than anything measured, and more the further out
+                double violation = violationWith(indices, levels);
+                feasible = violation == 0.0;
+                if (!feasible) {
+                    local->tell(localWorst == 0.0 ? HUGE_VAL : localWorst * (2.0 + violation));
+                    continue;
                 }
+                auto cached = localCache.find(levels);
+                if (cached == localCache.end() ||
+                    cached->second.count() < needed()) { break; }
+                local->tell(cached->second.estimate(TunerOptions::get().statistic));
             }
-            break;
+            if (!local->converged() && feasible) {
+                localPoint = levels;
+                localPending = true;
+            }
+        } else {
+            levels = localPoint;
         }
-        default:
-        {
-            break;
+        for (size_t d = 0 ; d < localDims.size() ; d++) {
+            size_t i = localDims[d];
+            outputs[i]->assignIndex(tuningVariableValues[i], levels[d]);
+            indices[i] = levels[d];
+        }
+    }
+    /* how far the local search's levels, with the other outputs as they
+     * are, would be outside the constraints */
+    double violationWith(SmallVector<size_t,8>& indices, const std::vector<size_t>& levels) {
+        if (feasibleSpace.empty()) { return 0.0; }
+        SmallVector<size_t,8> full;
+        for (size_t i = 0 ; i < indices.size() ; i++) { full.push_back(indices[i]); }
+        for (size_t d = 0 ; d < localDims.size() ; d++) { full[localDims[d]] = levels[d]; }
+        return feasibleSpace.violation(full.begin());
+    }
+    /* Draw the random outputs again a few times, and then move whatever
+     * still breaks a constraint to the nearest configuration that doesn't,
+     * keeping the local search's point if that is possible. */
+    void makeFeasible(Kokkos_Tools_VariableValue* tuningVariableValues,
+        SmallVector<size_t,8>& indices) {
+        if (feasibleSpace.feasible(indices.begin())) { return; }
+        std::vector<size_t> drawn;
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (bandits[i] == nullptr && !isLocal(i) && indices[i] != SIZE_MAX &&
+                feasibleSpace.constrained(i)) {
+                drawn.push_back(i);
+            }
+        }
+        for (size_t tries = 0 ; !drawn.empty() && tries < 32 ; tries++) {
+            for (auto i : drawn) { indices[i] = outputs[i]->randomIndex(); }
+            if (feasibleSpace.feasible(indices.begin())) { break; }
+        }
+        std::vector<bool> movable(outputs.size());
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            movable[i] = indices[i] != SIZE_MAX && !isLocal(i);
+        }
+        if (!feasibleSpace.repair(indices.begin(), movable)) {
+            for (size_t i = 0 ; i < outputs.size() ; i++) { movable[i] = indices[i] != SIZE_MAX; }
+            if (!feasibleSpace.repair(indices.begin(), movable)) {
+                mylog() << "No configuration of " << _description
+                        << " satisfies its constraints" << std::endl;
+            }
+        }
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (indices[i] != SIZE_MAX) {
+                outputs[i]->assignIndex(tuningVariableValues[i], indices[i]);
+            }
+        }
+    }
+    /* The defaults (or the cached result) are handed out until something
+     * better has been measured, so they have to satisfy the constraints too. */
+    void feasibleStart(void) {
+        SmallVector<size_t,8> indices;
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            size_t index{SIZE_MAX};
+            if (outputs[i] != nullptr && outputs[i]->numCandidates() > 0) {
+                index = outputs[i]->indexOf(bestValues[i]);
+                if (index == SIZE_MAX) { index = outputs[i]->numCandidates() / 2; }
+            }
+            indices.push_back(index);
+        }
+        if (feasibleSpace.feasible(indices.begin())) { return; }
+        std::vector<bool> movable(outputs.size());
+        for (size_t i = 0 ; i < outputs.size() ; i++) { movable[i] = indices[i] != SIZE_MAX; }
+        if (!feasibleSpace.repair(indices.begin(), movable)) {
+            mylog() << "No configuration of " << _description
+                    << " satisfies its constraints" << std::endl;
+            return;
+        }
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (feasibleSpace.constrained(i)) {
+                outputs[i]->space.assign(bestValues[i], indices[i]);
+            }
+        }
+    }
+    void updateLocal(double duration, const size_t* indices) {
+        std::vector<size_t> levels(localDims.size());
+        for (size_t d = 0 ; d < localDims.size() ; d++) {
+            levels[d] = indices[localDims[d]];
+        }
+        SampleStats& stats = localCache[levels];
+        stats.add(duration);
+        if (localPending && levels == localPoint && stats.count() >= needed()) {
+            localPending = false;
+            double estimate = stats.estimate(TunerOptions::get().statistic);
+            localWorst = std::max(localWorst, estimate);
+            local->tell(estimate);
+        }
+    }
+    /* Is there anything left to learn? Random variables never converge, so
+     * a search with any of them only stops at the trial limit. Unbounded
+     * outputs aren't searched at all, so they don't count. Call this with
+     * stateMutex held. */
+    bool convergedLocked(void) {
+        size_t limit = retuneUntil > 0 ? retuneUntil : TunerOptions::get().maxTrials;
+        if (limit > 0 && trials.load(std::memory_order_relaxed) >= limit) {
+            return true;
+        }
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (bandits[i] != nullptr) {
+                if (!bandits[i]->converged()) { return false; }
+            } else if (outputs[i] != nullptr && !isLocal(i) &&
+                       outputs[i]->numCandidates() > 0) {
+                return false;
+            }
+        }
+        return local == nullptr || local->converged();
+    }
+    /* A halving bandit that has finished has the last word on its output,
+     * so the best configuration is the one with the arm it kept. Call this
+     * with stateMutex and bestMutex held. */
+    void adoptSurvivors(void) {
+        std::vector<size_t> indices(outputs.size(), SIZE_MAX);
+        bool changed{false};
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (outputs[i] == nullptr || outputs[i]->numCandidates() == 0) { continue; }
+            indices[i] = outputs[i]->indexOf(bestValues[i]);
+            if (bandits[i] == nullptr || !bandits[i]->halving() ||
+                !bandits[i]->converged()) { continue; }
+            size_t survivor = bandits[i]->survivor();
+            if (indices[i] == survivor) { continue; }
+            indices[i] = survivor;
+            outputs[i]->space.assign(bestValues[i], survivor);
+            changed = true;
         }
+        if (!changed) { return; }
+        auto iter = configurations.find(configurationKey(indices.data()));
+        bestStats = iter == configurations.end() ? nullptr : &iter->second;
+        best_time.store(bestStats == nullptr ? HUGE_VAL :
+            bestStats->estimate(TunerOptions::get().statistic), std::memory_order_relaxed);
+        publishBest();
     }
+    /* The search is stopping: what it measured for the best is what later
+     * measurements are compared with. Call this with stateMutex and
+     * bestMutex held. */
+    void watch(void) {
+        if (bestStats != nullptr && bestStats->count() >= 2) {
+            drift.reset(bestStats->estimate(TunerOptions::get().statistic), bestStats->stddev());
+        } else {
+            drift.reset();
+        }
+    }
+    /* Stop searching. exploit() reads the best configuration without a
+     * lock, and bestValues changes again if the search starts over, so it
+     * gets a copy of its own that is never changed or freed while the
+     * search exists. Call this with bestMutex held (or before the search
+     * is shared). */
+    void startExploiting(void) {
+        snapshots.emplace_back(new std::vector<union Kokkos_Tools_VariableValue_ValueUnion>(bestValues));
+        exploitValues.store(snapshots.back()->data(), std::memory_order_release);
+        exploiting_.store(true, std::memory_order_release);
+    }
+    /* The best configuration has got slower for good. Forget everything
+     * measured so far and search again, starting from the best and with a
+     * small first step, for a limited number of trials. Call this with
+     * stateMutex held. */
+    void retune(void) {
+        std::lock_guard<std::mutex> guard(bestMutex);
+        if (!exploiting_.load(std::memory_order_relaxed)) { return; }
+        retunes++;
+        retuneUntil = trials.load(std::memory_order_relaxed) + TunerOptions::get().retuneTrials;
+        mylog() << "Search for " << _description << " got slower, searching again" << std::endl;
+        configurations.clear();
+        localCache.clear();
+        bestStats = nullptr;
+        best_time.store(HUGE_VAL, std::memory_order_relaxed);
+        for (size_t i = 0 ; i < outputs.size() ; i++) {
+            if (bandits[i] != nullptr) {
+                size_t index = outputs[i]->indexOf(bestValues[i]);
+                bandits[i].reset(makeBandit(outputs[i], index == SIZE_MAX ? 0 : index));
+            }
+        }
+        if (local != nullptr) { startLocal(refineSpread, false); }
+        exploitTrials = 0;
+        exploitTotal = 0.0;
+        localDone.store(false, std::memory_order_relaxed);
+        exploiting_.store(false, std::memory_order_release);
+    }
+    std::atomic<size_t> trials;
+    std::atomic<double> best_time;
+    /* the application reported its own objective for these contexts */
+    std::atomic<bool> reportedCost{false};
+    std::atomic<bool> exploiting_;
+    /* converged on this rank, waiting for the others to agree */
+    std::atomic<bool> localDone{false};
+    size_t exploitTrials;
+    double exploitTotal;
+    /* trials from earlier runs, if we started from the cache */
+    size_t warmTrials;
+    /* watches the measurements once the search has stopped */
+    DriftDetector drift;
+    /* how many times it searched again, and the trial count that search
+     * stops at */
+    size_t retunes{0};
+    size_t retuneUntil{0};
+    /* times of the contexts that had inner contexts */
+    std::atomic<size_t> nestedTrials;
+    std::atomic<size_t> inclusiveTotal;
+    std::atomic<size_t> exclusiveTotal;
+    /* protects bestValues and the switch to exploiting, always taken after
+     * stateMutex */
+    std::mutex bestMutex;
+    std::vector<union Kokkos_Tools_VariableValue_ValueUnion> bestValues;
+    /* what exploit() hands out, and every copy it ever pointed at (one more
+     * each time the search stops, under bestMutex) */
+    std::atomic<const union Kokkos_Tools_VariableValue_ValueUnion*> exploitValues{nullptr};
+    std::vector<std::unique_ptr<std::vector<union Kokkos_Tools_VariableValue_ValueUnion>>> snapshots;
+    /* the values the application would have used */
+    std::vector<union Kokkos_Tools_VariableValue_ValueUnion> defaults;
+    /* proposals made ahead of time by the worker, and its scratch space */
+    ReadySlots<IndexTuple,4> ready;
+    std::vector<Kokkos_Tools_VariableValue> scratch;
+};
+
+/* Human readable version of the input values, only built when a search is
+ * created. */
+std::string describeInputs(const size_t numContextVariables,
+    const Kokkos_Tools_VariableValue* contextVariableValues) {
+    std::stringstream ss;
+    std::string delimiter{""};
+    ss << "{";
+    for (size_t i = 0 ; i < numContextVariables ; i++) {
+        auto var = variables.find(contextVariableValues[i].type_id);
+        ss << delimiter;
+        if (var != nullptr && var->binned()) {
+            // the search is for the whole bin, not just this value
+            int64_t key = var->bins.keyFor(
+                Variable::numericValue(var->info.type, contextVariableValues[i].value));
+            ss << var->name << ": ";
+            if (key == 0) {
+                ss << "0";
+            } else {
+                ss << (key > 0 ? "[" : "(") << var->bins.lower(key) << ", "
+                   << var->bins.upper(key) << (key > 0 ? ")" : "]");
+            }
+        } else if (var != nullptr) {
+            ss << var->name << ": " << var->valueToString(contextVariableValues[i].value);
+        } else {
+            ss << contextVariableValues[i].type_id;
+        }
+        delimiter = ", ";
+    }
+    ss << "}";
+    std::string tmp{ss.str()};
+    return tmp;
 }
 
-std::map<size_t,Variable*> variables;
+/* Searches are created the first time a signature is seen and live until
+ * finalize. Lookups happen on every request, creation is rare. */
+class SearchTable {
+    private:
+    std::shared_mutex mutex_;
+    std::unordered_map<uint64_t,Search*> map_;
+    std::vector<Search*> all_; // in creation order, for the report
+    public:
+    Search* findOrCreate(const size_t numContextVariables,
+        const Kokkos_Tools_VariableValue* contextVariableValues,
+        const size_t numTuningVariables,
+        const Kokkos_Tools_VariableValue* tuningVariableValues) {
+        uint64_t signature = hashSignature(numContextVariables,
+            contextVariableValues, numTuningVariables, tuningVariableValues);
+        /* Each thread remembers the searches it used recently, so the common
+         * case doesn't touch the shared lock at all. Searches are never
+         * deleted before finalize, so the pointers stay good. */
+        static constexpr size_t cacheSize{64};
+        struct CacheEntry { uint64_t signature{0}; Search* search{nullptr}; };
+        static thread_local CacheEntry cache[cacheSize];
+        CacheEntry& entry = cache[signature % cacheSize];
+        if (entry.search != nullptr && entry.signature == signature) {
+            return entry.search;
+        }
+        Search* search = lookup(signature, numContextVariables,
+            contextVariableValues, numTuningVariables, tuningVariableValues);
+        entry.signature = signature;
+        entry.search = search;
+        return search;
+    }
+    /* only called from finalize, when no other hooks are running */
+    std::vector<Search*>& unsafeAll(void) { return all_; }
+    void clear(void) {
+        std::unique_lock<std::shared_mutex> guard(mutex_);
+        for (auto search : all_) {
+            delete search;
+        }
+        all_.clear();
+        map_.clear();
+    }
+    private:
+    Search* lookup(uint64_t signature, const size_t numContextVariables,
+        const Kokkos_Tools_VariableValue* contextVariableValues,
+        const size_t numTuningVariables,
+        const Kokkos_Tools_VariableValue* tuningVariableValues) {
+        {
+            std::shared_lock<std::shared_mutex> guard(mutex_);
+            auto iter = map_.find(signature);
+            if (iter != map_.end()) { return iter->second; }
+        }
+        std::unique_lock<std::shared_mutex> guard(mutex_);
+        // someone else may have beaten us to it
+        auto iter = map_.find(signature);
+        if (iter != map_.end()) { return iter->second; }
+        Search* search = new Search(signature,
+            describeInputs(numContextVariables, contextVariableValues),
+            numContextVariables, contextVariableValues,
+            numTuningVariables, tuningVariableValues);
+        map_[signature] = search;
+        all_.push_back(search);
+        if (telemetry.enabled()) { search->describeTelemetry(); }
+        count_.store(all_.size(), std::memory_order_release);
+        return search;
+    }
+    std::atomic<size_t> count_{0};
+    public:
+    size_t count(void) const { return count_.load(std::memory_order_acquire); }
+    /* the search for a signature, if this rank has one */
+    Search* find(uint64_t signature) {
+        std::shared_lock<std::shared_mutex> guard(mutex_);
+        auto iter = map_.find(signature);
+        return iter == map_.end() ? nullptr : iter->second;
+    }
+    /* copy of all the searches, for the background worker */
+    void snapshot(std::vector<Search*>& out) {
+        std::shared_lock<std::shared_mutex> guard(mutex_);
+        out = all_;
+    }
+};
+
+SearchTable searches;
+
+/* The background worker for KOKKOS_TUNING_ASYNC. end_context pushes its
+ * measurement into a lock-free queue, and the worker applies them to the
+ * searches and keeps a few proposals ready for every search that is still
+ * running. request_values then only takes a ready proposal, or hands out
+ * the best configuration so far if there isn't one, so the hooks cost the
+ * same whatever the strategies cost. */
+class AsyncWorker {
+    public:
+    struct Measurement {
+        Search* search;
+        double duration;
+        bool exploit;
+        Search::IndexTuple tuple;
+    };
+    AsyncWorker() : running_(false), stopping_(false) { }
+    bool running(void) const { return running_.load(std::memory_order_acquire); }
+    void start(void) {
+        if (running()) { return; }
+        stopping_.store(false);
+        thread_ = std::thread([this]() { run(); });
+        running_.store(true, std::memory_order_release);
+    }
+    /* finish what is in the queue, and stop */
+    void stop(void) {
+        if (!running()) { return; }
+        stopping_.store(true, std::memory_order_release);
+        thread_.join();
+        running_.store(false, std::memory_order_release);
+    }
+    /* false if the queue is full, then the caller does the update itself */
+    bool push(const Measurement& measurement) {
+        return queue_.push(measurement);
+    }
+    private:
+    BoundedQueue<Measurement,4096> queue_;
+    std::atomic<bool> running_;
+    std::atomic<bool> stopping_;
+    std::thread thread_;
+    std::vector<Search*> known_;
+    void run(void) {
+        for (;;) {
+            bool stopping = stopping_.load(std::memory_order_acquire);
+            bool busy = drain();
+            if (stopping) { break; }
+            if (searches.count() != known_.size()) {
+                searches.snapshot(known_);
+            }
+            for (auto search : known_) {
+                busy = search->refill() || busy;
+            }
+            if (!busy) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+    bool drain(void) {
+        Measurement measurement;
+        bool any{false};
+        while (queue_.pop(measurement)) {
+            any = true;
+            if (measurement.exploit) {
+                measurement.search->updateExploit(measurement.duration);
+            } else {
+                measurement.search->updateIndices(measurement.duration,
+                    measurement.tuple.indices);
+            }
+        }
+        return any;
+    }
+};
+
+AsyncWorker asyncWorker;
 
+/* A context can be opened inside another one, like the per-smoother
+ * contexts inside the meta smoother context of meta-smoother-discrete. The
+ * inner context's time is part of the outer one's (inclusive) time, but how
+ * long the inner one took depends on what its own search handed out. So the
+ * outer context is credited with its exclusive time plus the best time its
+ * inner contexts' searches have found so far, which is what it would cost
+ * with the inner parameters tuned. */
 class Context {
     private:
-    size_t _id;
-    std::vector<size_t> inputVariables;
-    std::vector<size_t> outputVariables;
-    std::chrono::time_point<std::chrono::high_resolution_clock> start_time_;
+    /* atomic, because a stale ContextStack entry on another thread may
+     * read it while the context is reused */
+    std::atomic<size_t> _id;
+    SmallVector<size_t,8> inputVariables;
+    Search* search;
+    SmallVector<union Kokkos_Tools_VariableValue_ValueUnion,8> outputValues;
+    SmallVector<size_t,8> outputIndices;
+    bool exploiting;
+    bool measure;
+    /* the enclosing context, if it was open on this thread */
+    Context* parent;
+    size_t parentId;
+    /* inclusive time of the inner contexts, and what they are credited with */
+    size_t childTime;
+    double childBest;
+    /* weighted sum of the objectives the application reported */
+    double reported;
+    bool hasReported;
+    /* what the search was credited with */
+    double cost_;
+    /* Meter reading at the start, in the units of the objective */
+    uint64_t start_value_;
     public:
-    Context(size_t id) : _id(id) { }
+    Context(size_t id) : _id(id), search(nullptr), exploiting(false), measure(false),
+        parent(nullptr), parentId(0), childTime(0), childBest(0.0),
+        reported(0.0), hasReported(false), cost_(0.0) { }
+    size_t id(void) const { return _id.load(std::memory_order_relaxed); }
+    /* get ready for reuse from the pool */
+    void reset(size_t id) {
+        _id.store(id, std::memory_order_relaxed);
+        inputVariables.clear();
+        search = nullptr;
+        outputValues.clear();
+        outputIndices.clear();
+        exploiting = false;
+        measure = false;
+        parent = nullptr;
+        parentId = 0;
+        childTime = 0;
+        childBest = 0.0;
+        reported = 0.0;
+        hasReported = false;
+        cost_ = 0.0;
+    }
+    /* finished, so stale references to it no longer match */
+    void retire(void) { _id.store(SIZE_MAX, std::memory_order_relaxed); }
+    void setParent(Context* context) {
+        parent = context;
+        parentId = context == nullptr ? 0 : context->id();
+    }
+    /* the parent, if it is still the same context */
+    Context* liveParent(void) {
+        if (parent == nullptr || parent->id() != parentId) { return nullptr; }
+        return parent;
+    }
+    /* an inner context has finished */
+    void addChild(size_t inclusive, double best) {
+        childTime += inclusive;
+        childBest += best;
+    }
+    /* the application's own measure of how this context went */
+    void reportObjective(const char* name, double value) {
+        reported += TunerOptions::get().weightOf(name) * value;
+        hasReported = true;
+    }
     void addInputVariables(const size_t numContextVariables,
         const Kokkos_Tools_VariableValue* contextVariableValues) {
         for (auto i = 0 ; i < numContextVariables ; i++ ) {
             inputVariables.push_back(contextVariableValues[i].type_id);
         }
     }
-    void addOutputVariables(const size_t numTuningVariables,
+    void addOutputVariables(const size_t numContextVariables,
+        const Kokkos_Tools_VariableValue* contextVariableValues,
+        const size_t numTuningVariables,
         Kokkos_Tools_VariableValue* tuningVariableValues) {
-        for (auto i = 0 ; i < numTuningVariables ; i++ ) {
-            outputVariables.push_back(tuningVariableValues[i].type_id);
-            // look up the variable, and assign a new value
-            auto iter = variables.find(tuningVariableValues[i].type_id);
-            auto var = iter->second;
-            var->assignNewValue(tuningVariableValues[i]);
+        // find the search for this signature, and get the next configuration
+        search = searches.findOrCreate(numContextVariables,
+            contextVariableValues, numTuningVariables, tuningVariableValues);
+        if (search->exploiting()) {
+            search->exploit(tuningVariableValues);
+            exploiting = true;
+            measure = sampleExploit();
+            return;
+        }
+        if (asyncWorker.running() && search->asyncCapable()) {
+            measure = search->takeProposal(tuningVariableValues, outputIndices);
+            if (!measure) {
+                search->fallback(tuningVariableValues);
+                return;
+            }
+        } else {
+            measure = true;
+            search->propose(tuningVariableValues, outputIndices);
         }
-        
+        // remember what we handed out, for this context only: if the
+        // worker's queue is full, the measurement is credited in the hooks
+        for (size_t i = 0 ; i < numTuningVariables ; i++ ) {
+            outputValues.push_back(tuningVariableValues[i].value);
+        }
+    }
+    /* Measure about one in every exploitSampling contexts of a converged
+     * search. This is a coin flip from the per-thread generator, so the fast
+     * path doesn't share a counter between threads, and the samples don't
+     * alias with whatever pattern the application calls contexts in. */
+    static bool sampleExploit(void) {
+        size_t every = TunerOptions::get().exploitSampling;
+        if (every == 0) { return false; }
+        return TunerRandom::get().below(every) == 0;
     }
+    /* Timed if its own measurement was chosen, or its parent is timed and
+     * needs the time of the contexts inside it. Once the searches have
+     * stopped, the inner contexts of a parent that isn't sampled don't
+     * fence or read the meter either. */
+    bool timed(void) {
+        if (measure) { return true; }
+        Context* outer = liveParent();
+        return outer != nullptr && outer->timed();
+    }
+    /* timed, but never credited to a search: for calibrating the overhead */
+    void probe(void) { measure = true; }
     void start(void) {
-        start_time_ = std::chrono::high_resolution_clock::now();
+        if (!timed()) { return; }
+        Meter::calibrate();
+        start_value_ = Meter::start();
+    }
+    /* Returns the inclusive duration, 0 if this context wasn't timed, from
+     * the reading the end hook took (see kokkosp_end_context). The search is
+     * credited with the exclusive time plus the best times of the inner
+     * contexts (or with the reported objectives, if there were any), and
+     * the parent hears about this one. */
+    size_t stop(uint64_t end_value) {
+        if (!timed() || search == nullptr) { return 0; }
+        if (!Meter::valid(start_value_, end_value)) {
+            // no counter on this thread, which is no reason to think it cost nothing
+            if (measure && !exploiting) { search->abandon(outputIndices.begin()); }
+            measure = false;
+            return 0;
+        }
+        size_t inclusive = Meter::elapsed(start_value_, end_value);
+        size_t exclusive = inclusive > childTime ? inclusive - childTime : 0;
+        double duration = (double)exclusive + childBest;
+        double cost = hasReported ?
+            reported + TunerOptions::get().measuredWeight * duration : duration;
+        cost_ = cost;
+        if (childTime > 0) {
+            search->addNestedTimes(inclusive, exclusive);
+        }
+        if (hasReported) { search->markReported(); }
+        if (measure && asyncWorker.running() && search->asyncCapable() &&
+            pushMeasurement(cost)) {
+            // the worker will take it from here
+        } else if (measure && exploiting) {
+            search->updateExploit(cost);
+        } else if (measure) {
+            search->update(cost, outputValues.begin(), outputIndices.begin());
+        }
+        Context* outer = liveParent();
+        if (outer != nullptr && outer->timed()) {
+            // the parent measures, so it can't use a best in reported units
+            double best = hasReported ? HUGE_VAL : search->bestTime();
+            outer->addChild(inclusive, best == HUGE_VAL ? duration : best);
+        }
+        return inclusive;
+    }
+    bool pushMeasurement(double cost) {
+        AsyncWorker::Measurement measurement;
+        measurement.search = search;
+        measurement.duration = cost;
+        measurement.exploit = exploiting;
+        std::copy(outputIndices.begin(), outputIndices.end(), measurement.tuple.indices);
+        return asyncWorker.push(measurement);
+    }
+    void traceRequest(void) {
+        if (search == nullptr) { return; }
+        trace.record(exploiting ? TraceRing::Kind::Exploit : TraceRing::Kind::Request,
+            _id, search->signature(), 0, outputIndices.begin(), outputIndices.size());
+    }
+    uint64_t signature(void) const {
+        return search == nullptr ? 0 : search->signature();
+    }
+    /* Only the measured trials remember what they were handed, keep the
+     * values of the others too for the telemetry. */
+    void keepValues(const size_t numTuningVariables,
+        const Kokkos_Tools_VariableValue* tuningVariableValues) {
+        if (outputValues.size() == numTuningVariables) { return; }
+        outputValues.clear();
+        for (size_t i = 0 ; i < numTuningVariables ; i++ ) {
+            outputValues.push_back(tuningVariableValues[i].value);
+        }
+    }
+    void recordTelemetry(size_t inclusive) {
+        if (search == nullptr) { return; }
+        TelemetryWriter::Row row;
+        row.contextId = id();
+        row.signature = search->signature();
+        row.cost = cost_;
+        row.duration = inclusive;
+        row.flags = (measure ? (uint32_t)TelemetryWriter::Measured : 0u) |
+                    (exploiting ? (uint32_t)TelemetryWriter::Exploit : 0u) |
+                    (hasReported ? (uint32_t)TelemetryWriter::Reported : 0u) |
+                    (childTime > 0 ? (uint32_t)TelemetryWriter::Nested : 0u);
+        row.numValues = (uint32_t)outputValues.size();
+        for (size_t i = 0 ; i < TelemetryWriter::maxValues ; i++) {
+            row.values[i] = i < outputValues.size() ?
+                search->telemetryBits(i, outputValues[i]) : 0;
+        }
+        telemetry.record(row);
+    }
+};
+
+/* Contexts are created and destroyed on every tuned region, possibly from
+ * many threads at once. Shard the table by context id so that threads
+ * working on independent contexts take different locks.
+ *
+ * Within a shard, live contexts are kept in an open addressing table indexed
+ * by context id (Kokkos hands out sequential ids, so they spread evenly
+ * across slots), and finished contexts go back on a free list to be reused.
+ * Once the tables and pools have grown to the number of contexts that are
+ * live at once, begin/end does no heap allocation. */
+class ContextTable {
+    private:
+    static constexpr size_t numShards{64};
+    static constexpr size_t initialSlots{16};
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::vector<Context*> slots;
+        size_t count{0};
+        std::vector<Context*> pool;
+        Shard() : slots(initialSlots, nullptr) { }
+    };
+    Shard shards[numShards];
+    Shard& shardFor(size_t id) { return shards[id % numShards]; }
+    static size_t slotFor(const Shard& shard, size_t id) {
+        return (id / numShards) & (shard.slots.size() - 1);
+    }
+    static void place(Shard& shard, Context* context) {
+        size_t mask = shard.slots.size() - 1;
+        size_t slot = slotFor(shard, context->id());
+        while (shard.slots[slot] != nullptr) {
+            slot = (slot + 1) & mask;
+        }
+        shard.slots[slot] = context;
+    }
+    static void grow(Shard& shard) {
+        std::vector<Context*> old(shard.slots.size() * 2, nullptr);
+        old.swap(shard.slots);
+        for (auto context : old) {
+            if (context != nullptr) { place(shard, context); }
+        }
+    }
+    static size_t findSlot(const Shard& shard, size_t id) {
+        size_t mask = shard.slots.size() - 1;
+        size_t slot = slotFor(shard, id);
+        while (shard.slots[slot] != nullptr) {
+            if (shard.slots[slot]->id() == id) { return slot; }
+            slot = (slot + 1) & mask;
+        }
+        return shard.slots.size();
     }
-    void stop() {
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time_).count();
-        for ( auto v : outputVariables) {
-            auto iter = variables.find(v);
-            auto var = iter->second;
-            var->updateBests(duration);
+    public:
+    /* get a context for this id, recycled if we have one */
+    Context* create(size_t id) {
+        Shard& shard = shardFor(id);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        Context* context;
+        if (shard.pool.empty()) {
+            context = new Context(id);
+        } else {
+            context = shard.pool.back();
+            shard.pool.pop_back();
+            context->reset(id);
+        }
+        // keep the load under half, so probes stay short
+        if ((shard.count + 1) * 2 > shard.slots.size()) {
+            grow(shard);
+        }
+        place(shard, context);
+        shard.count++;
+        return context;
+    }
+    Context* find(size_t id) {
+        Shard& shard = shardFor(id);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        size_t slot = findSlot(shard, id);
+        if (slot == shard.slots.size()) { return nullptr; }
+        return shard.slots[slot];
+    }
+    /* removes the context from the table, the caller gives it back with recycle() */
+    Context* remove(size_t id) {
+        Shard& shard = shardFor(id);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        size_t slot = findSlot(shard, id);
+        if (slot == shard.slots.size()) { return nullptr; }
+        Context* context = shard.slots[slot];
+        // backward shift deletion, so lookups never need tombstones
+        size_t mask = shard.slots.size() - 1;
+        size_t hole = slot;
+        size_t next = (hole + 1) & mask;
+        while (shard.slots[next] != nullptr) {
+            size_t home = slotFor(shard, shard.slots[next]->id());
+            // can the entry at 'next' move back into the hole?
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                shard.slots[hole] = shard.slots[next];
+                hole = next;
+            }
+            next = (next + 1) & mask;
+        }
+        shard.slots[hole] = nullptr;
+        shard.count--;
+        return context;
+    }
+    void recycle(Context* context) {
+        Shard& shard = shardFor(context->id());
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        context->retire();
+        shard.pool.push_back(context);
+    }
+    void clear(void) {
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            for (auto& context : shard.slots) {
+                delete context;
+                context = nullptr;
+            }
+            for (auto context : shard.pool) {
+                delete context;
+            }
+            shard.pool.clear();
+            shard.count = 0;
+        }
+    }
+};
+
+ContextTable contexts;
+
+/* The contexts open on this thread, innermost last, for the parent links.
+ * Entries remember the id they were pushed with, so a context that was
+ * ended out of order (or on another thread) and reused is skipped. */
+class ContextStack {
+    public:
+    static ContextStack& get(void) {
+        static thread_local ContextStack stack;
+        return stack;
+    }
+    Context* top(void) {
+        while (!entries_.empty()) {
+            const Entry& entry = entries_.back();
+            if (entry.context->id() == entry.id) { return entry.context; }
+            entries_.pop_back();
         }
+        return nullptr;
+    }
+    void push(Context* context) {
+        entries_.push_back(Entry{context, context->id()});
     }
+    /* pop this context, and anything left open inside it */
+    void remove(Context* context) {
+        for (size_t i = entries_.size() ; i > 0 ; i--) {
+            if (entries_[i - 1].context == context) {
+                entries_.resize(i - 1);
+                return;
+            }
+        }
+    }
+    private:
+    struct Entry {
+        Context* context;
+        size_t id;
+    };
+    std::vector<Entry> entries_;
+    ContextStack() { entries_.reserve(16); }
 };
 
-std::map<size_t,Context*> contexts;
-std::stack<Context*> contextStack;
+/* The reading that ends a context, taken before the end hook does anything
+ * else: contexts end innermost first, so the one ending is normally the top
+ * of this thread's stack and doesn't have to be looked up. Returns false
+ * (and takes no reading) for any other context, or one that isn't timed. */
+bool endReading(const size_t contextId, uint64_t& end) {
+    Context* current = ContextStack::get().top();
+    if (current == nullptr || current->id() != contextId || !current->timed()) {
+        return false;
+    }
+    end = Meter::stop();
+    return true;
+}
+
+/* One measurement of nothing, for calibrating the overhead: the reading at
+ * the end of request_values and then what the end hook does up to its own
+ * reading, on a context that never reaches the table. */
+uint64_t emptyMeasurement(void) {
+    ContextStack& stack = ContextStack::get();
+    Context probe(SIZE_MAX - 1);
+    probe.probe();
+    stack.push(&probe);
+    uint64_t start = Meter::start();
+    uint64_t end{start};
+    endReading(probe.id(), end);
+    stack.remove(&probe);
+    return Meter::difference(start, end);
+}
+
+/* Apply the last exchange with the other ranks: for every signature, the
+ * cheapest record wins (the lowest rank on a tie), so all the ranks pick the
+ * same one. The search is done once any rank's search is. */
+void mergeResults(void) {
+    struct Winner { const MpiExchange::Record* record; uint64_t trials; bool converged; };
+    std::unordered_map<uint64_t,Winner> winners;
+    for (const auto& record : exchange.incoming()) {
+        if (record.signature == 0) { continue; }
+        auto iter = winners.find(record.signature);
+        if (iter == winners.end()) {
+            winners[record.signature] = Winner{&record, record.trials, record.converged != 0};
+            continue;
+        }
+        iter->second.trials += record.trials;
+        iter->second.converged = iter->second.converged || record.converged != 0;
+        if (record.cost < iter->second.record->cost) { iter->second.record = &record; }
+    }
+    for (const auto& winner : winners) {
+        Search* search = searches.find(winner.first);
+        if (search != nullptr) {
+            search->adoptBest(*winner.second.record, winner.second.trials, winner.second.converged);
+        }
+    }
+}
+
+/* Start an exchange with the bests of (up to) maxRecords searches, taking
+ * turns when there are more. */
+void shareResults(void) {
+    static std::vector<Search*> all;
+    static size_t next{0};
+    searches.snapshot(all);
+    size_t count{0};
+    for (size_t i = 0 ; i < all.size() && count < MpiExchange::maxRecords ; i++) {
+        if (all[(next + i) % all.size()]->shareBest(exchange.outgoing()[count])) { count++; }
+    }
+    if (!all.empty()) { next = (next + count) % all.size(); }
+    exchange.post(count);
+}
+
+/* From end_context, on the thread that talks to MPI: every mpiInterval
+ * contexts, finish the exchange in flight (if it is done) and start the
+ * next one. */
+void exchangeResults(void) {
+    static size_t ticks{0};
+    if (!exchange.owner() || ++ticks % TunerOptions::get().mpiInterval != 0) { return; }
+    if (exchange.busy()) {
+        if (!exchange.test()) { return; }
+        mergeResults();
+    }
+    shareResults();
+}
 
 extern "C" {
 /*
@@ -585,10 +2398,13 @@ extern "C" {
 void kokkosp_declare_output_type(const char* name, const size_t id,
     Kokkos_Tools_VariableInfo& info) {
     mylog() << __FUNCTION__ << " " << name << std::endl;
-    Variable * output = new Variable(id, name, info);
-    mylog() << output->toString() << std::endl;
+    Variable * output = variables.allocate(id, name, info, true);
+    // we get this pointer back with every value of this type
+    info.toolProvidedInfo = output;
     output->makeSpace();
-    variables[id] = output;
+    output->chooseStrategy();
+    mylog() << output->toString() << std::endl;
+    variables.insert(id, output);
     return;
 }
 
@@ -601,9 +2417,10 @@ void kokkosp_declare_output_type(const char* name, const size_t id,
 void kokkosp_declare_input_type(const char* name, const size_t id,
     Kokkos_Tools_VariableInfo& info) {
     mylog() << __FUNCTION__ << " " << name << std::endl;
-    Variable * input = new Variable(id, name, info, false);
+    Variable * input = variables.allocate(id, name, info, false);
+    info.toolProvidedInfo = input;
     mylog() << input->toString() << std::endl;
-    variables[id] = input;
+    variables.insert(id, input);
 }
 
 /* This starts the context pointed at by contextId. If tools use
@@ -612,7 +2429,11 @@ void kokkosp_declare_input_type(const char* name, const size_t id,
  */
 void kokkosp_begin_context(size_t contextId) {
     mylog() << __FUNCTION__ << "\t" << contextId << std::endl;
-    contexts[contextId] = new Context(contextId);
+    Context* context = contexts.create(contextId);
+    ContextStack& stack = ContextStack::get();
+    context->setParent(stack.top());
+    stack.push(context);
+    trace.record(TraceRing::Kind::Begin, contextId, 0);
 }
 
 /* Here Kokkos is requesting the values of tuning variables, and most
@@ -642,20 +2463,27 @@ void kokkosp_request_values(
     const size_t numTuningVariables,
     Kokkos_Tools_VariableValue* tuningVariableValues) {
     // get the context
-    auto iter = contexts.find(contextId);
-    auto context = iter->second;
-    mylog() << __FUNCTION__ << "\ncontext id: " << contextId << std::endl;
-    mylog() << numContextVariables << " input variables with ids: ";
-    for (auto i = 0 ; i < numContextVariables ; i++ ) {
-        mylog() << contextVariableValues[i].type_id << " ";
+    auto context = contexts.find(contextId);
+    if (context == nullptr) { return; }
+    if (tunerLog.enabled()) {
+        mylog() << __FUNCTION__ << "\ncontext id: " << contextId << std::endl;
+        mylog() << numContextVariables << " input variables with ids: ";
+        for (auto i = 0 ; i < numContextVariables ; i++ ) {
+            mylog() << contextVariableValues[i].type_id << " ";
+        }
+        mylog() << "\n" << numTuningVariables << " output variables with ids: ";
+        for (auto i = 0 ; i < numTuningVariables ; i++ ) {
+            mylog() << tuningVariableValues[i].type_id << " ";
+        }
+        mylog() << "\n" << std::endl;
     }
     context->addInputVariables(numContextVariables, contextVariableValues);
-    mylog() << "\n" << numTuningVariables << " output variables with ids: ";
-    for (auto i = 0 ; i < numTuningVariables ; i++ ) {
-        mylog() << tuningVariableValues[i].type_id << " ";
+    context->addOutputVariables(numContextVariables, contextVariableValues,
+        numTuningVariables, tuningVariableValues);
+    if (trace.enabled()) { context->traceRequest(); }
+    if (telemetry.enabled()) {
+        context->keepValues(numTuningVariables, tuningVariableValues);
     }
-    mylog() << "\n" << std::endl;
-    context->addOutputVariables(numTuningVariables, tuningVariableValues);
     context->start();
 }
 
@@ -664,12 +2492,63 @@ void kokkosp_request_values(
  * values can now be associated with a result.
  */
 void kokkosp_end_context(const size_t contextId) {
+    // before anything else the tuner does, so it isn't measured
+    uint64_t end{0};
+    bool early = endReading(contextId, end);
     mylog() << __FUNCTION__ << "\t" << contextId << std::endl;
-    auto iter = contexts.find(contextId);
-    auto context = iter->second;
-    context->stop();
-    delete context;
-    contexts.erase(contextId);
+    auto context = contexts.remove(contextId);
+    if (context == nullptr) { return; }
+    if (!early && context->timed()) { end = Meter::stop(); }
+    ContextStack::get().remove(context);
+    size_t duration = context->stop(end);
+    trace.record(TraceRing::Kind::End, contextId, context->signature(), duration);
+    if (telemetry.enabled()) { context->recordTelemetry(duration); }
+    contexts.recycle(context);
+    if (exchange.enabled()) { exchangeResults(); }
+}
+
+/* Not a Kokkos hook: the application reports its own objective for a
+ * context (iterations to converge, an error, a count...) before ending it,
+ * and the search minimizes the weighted sum of what was reported instead of
+ * the measured objective. Look it up with dlsym, see reportObjective() in
+ * tuning_playground.hpp.
+ */
+void simple_tuner_report_objective(const size_t contextId, const char* name,
+    const double value) {
+    mylog() << __FUNCTION__ << "\t" << contextId << "\t" << name << " = " << value << std::endl;
+    auto context = contexts.find(contextId);
+    if (context == nullptr) { return; }
+    context->reportObjective(name, value);
+}
+
+/* Not a Kokkos hook: trials are about to run side by side on instances of
+ * the device (1), or have finished (0), see BatchedTrials in
+ * tuning_playground.hpp. The fence Kokkos gives tools is for the whole
+ * device, so until they finish measurements aren't fenced, and each trial
+ * fences its own instance before it ends its context instead.
+ */
+void simple_tuner_batch(const int running) {
+    mylog() << __FUNCTION__ << "\t" << running << std::endl;
+    Meter::holdFence(running != 0);
+}
+
+/* Not Kokkos hooks either: constraints between output variables, which the
+ * searches that have all of them as outputs respect. Declare them after the
+ * variables and before the first context that requests them. The product
+ * of the values of the variables must be at most the bound, */
+void simple_tuner_constrain_product(const size_t count, const size_t* ids,
+    const double bound) {
+    mylog() << __FUNCTION__ << "\t" << count << " variables, bound " << bound << std::endl;
+    constraintTable.add(Constraint{std::vector<size_t>(ids, ids + count), bound, nullptr, nullptr});
+}
+
+/* or valid() must return non-zero for their values (in the order of ids),
+ * and may be called from any thread that requests values. */
+void simple_tuner_constrain(const size_t count, const size_t* ids,
+    simple_tuner_valid_fn valid, void* data) {
+    mylog() << __FUNCTION__ << "\t" << count << " variables" << std::endl;
+    if (valid == nullptr) { return; }
+    constraintTable.add(Constraint{std::vector<size_t>(ids, ids + count), 0.0, valid, data});
 }
 
 /* This function will be called only once, prior to calling any other hooks
@@ -682,6 +2561,45 @@ void kokkosp_end_context(const size_t contextId) {
 void kokkosp_init_library(const int, const uint64_t, const uint32_t,
     struct Kokkos_Profiling_KokkosPDeviceInfo*) {
     mylog() << __FUNCTION__ << std::endl;
+    if (TunerOptions::get().mpi && exchange.start()) {
+        mylog() << "Sharing results with " << exchange.size() - 1 << " other ranks" << std::endl;
+    }
+    // before anybody draws a random number, and different on every rank
+    TunerRandom::seed(TunerOptions::get().seed + (uint64_t)exchange.rank());
+    if (!TunerOptions::get().tracePath.empty()) {
+        trace.enable(TunerOptions::get().traceEvents);
+    }
+    const std::string& telemetryPath = TunerOptions::get().telemetryPath;
+    if (!telemetryPath.empty() &&
+        !telemetry.start(telemetryPath, TunerOptions::get().telemetryRows)) {
+        std::cerr << "Unable to write the telemetry " << telemetryPath << std::endl;
+    }
+    Objective objective = Meter::configure(TunerOptions::get().objective);
+    if (objective != TunerOptions::get().objective) {
+        std::cerr << "Unable to measure " << pObjective(TunerOptions::get().objective)
+                  << ", tuning on " << pObjective(objective) << " instead" << std::endl;
+    }
+    Meter::setOverhead(TunerOptions::get().calibrate ? emptyMeasurement : nullptr,
+        TunerOptions::get().overhead);
+    if (TunerOptions::get().async) {
+        asyncWorker.start();
+    }
+    const std::string& path = TunerOptions::get().cachePath;
+    if (!path.empty()) {
+        size_t count = tuningCache.load(path);
+        mylog() << "Read " << count << " cached results from " << path << std::endl;
+    }
+}
+
+/* Kokkos calls this after init with the functions a tool can call back,
+ * of which only the first (fence) exists so far. Measurements fence with it,
+ * so that they end when the kernels are done instead of when they were
+ * launched. */
+void kokkosp_provide_tool_programming_interface(const uint32_t numActions,
+    Kokkos_Tools_ToolProgrammingInterface actions) {
+    mylog() << __FUNCTION__ << "\t" << numActions << " actions" << std::endl;
+    if (numActions < 1 || actions.fence == nullptr) { return; }
+    Meter::setFence(actions.fence, TunerOptions::get().fence);
 }
 
 /* This function will be called only once, after all other calls to
@@ -689,27 +2607,75 @@ void kokkosp_init_library(const int, const uint64_t, const uint32_t,
  */
 void kokkosp_finalize_library() {
     mylog() << __FUNCTION__ << std::endl;
+    // apply whatever measurements are still queued
+    asyncWorker.stop();
+    mylog() << "Measurements " << (Meter::fenced() ? "fenced" : "not fenced")
+            << ", overhead of " << Meter::overhead() << " "
+            << objectiveUnits(Meter::objective()) << " subtracted" << std::endl;
+    if (telemetry.enabled()) {
+        uint64_t dropped = telemetry.dropped();
+        size_t count = telemetry.stop();
+        mylog() << "Wrote " << count << " telemetry rows to "
+                << TunerOptions::get().telemetryPath << std::endl;
+        if (dropped > 0) {
+            std::cerr << "Dropped " << dropped << " telemetry rows, the writer fell behind" << std::endl;
+        }
+    }
+    if (exchange.enabled()) {
+        // one last exchange that everybody takes part in, so the ranks
+        // report (and cache) the same results
+        exchange.align();
+        shareResults();
+        exchange.wait();
+        mergeResults();
+        exchange.stop();
+    }
+    // with MPI, the other ranks have the same results
+    bool report = exchange.rank() == 0;
     std::string banner(80, '*');
     if (variables.size() == 0) {
         std::cerr << banner << std::endl;
         std::cerr << "No variables tuned! did you configure Kokkos with `-DKokkos_ENABLE_TUNING=TRUE`?\n" << banner << std::endl;
-    } else {
-        std::cout << "Best values found:\n" << banner << std::endl;
-        for (const auto& k : variables) {
-            auto v = k.second;
-            v->reportBest();
-	    delete v;
+    } else if (report) {
+        std::cout << "Best values found";
+        if (Meter::objective() != Objective::Time) {
+            std::cout << " (by " << pObjective(Meter::objective()) << ")";
+        }
+        std::cout << ":\n" << banner << std::endl;
+        for (auto search : searches.unsafeAll()) {
+            search->reportBest();
+        }
+        const std::string& path = TunerOptions::get().cachePath;
+        if (!path.empty()) {
+            // merge with what we read, so results for contexts that didn't
+            // run this time are kept
+            for (auto search : searches.unsafeAll()) {
+                TuningCache::Record record;
+                if (search->makeRecord(record)) {
+                    tuningCache.store(record);
+                }
+            }
+            if (!tuningCache.save(path)) {
+                std::cerr << "Unable to write the tuning cache " << path << std::endl;
+            }
         }
-	variables.clear();
         std::cout << banner << std::endl;
     }
-    // do cleanup
-    // Iterate through the map and delete the pointers
-    for (auto& pair : contexts) {
-        delete pair.second;
-        pair.second = nullptr; // Optional: set to nullptr to avoid dangling pointers
+    if (tunerLog.enabled()) {
+        // the bins only count their values, so this is where they are shown
+        for (auto var : variables.unsafeAll()) {
+            if (var->binned()) { mylog() << var->toString(); }
+        }
+    }
+    searches.clear();
+    variables.clear();
+    const std::string& tracePath = TunerOptions::get().tracePath;
+    if (trace.enabled()) {
+        size_t count = trace.dump(tracePath);
+        mylog() << "Wrote " << count << " trace events to " << tracePath << std::endl;
     }
-    contexts.clear(); // Remove all elements from the map (now empty)
+    // do cleanup
+    contexts.clear();
 }
 
 
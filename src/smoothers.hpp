@@ -0,0 +1,230 @@
+#pragma once
+
+/* Real smoothers for the meta-smoother demos, so that the tuned parameters
+ * change real work: a Chebyshev polynomial smoother, a multi-threaded
+ * (red-black) Gauss-Seidel and a two-stage Gauss-Seidel, used as solvers
+ * for a shifted Laplacian in CRS format.
+ *
+ * Every call solves A x = b from x = 0 until the residual has dropped by
+ * the tolerance, so a setting that does less work per application but
+ * needs more of them (or checks the residual too often, or too rarely) shows
+ * up in the time. The problem is (shift I + L) on an n^2 or n^3 grid, with
+ * the shift picked for a condition number of about 30: inside the range of
+ * eigenvalue ratios the demos search, and small enough that a solve takes
+ * tens of iterations rather than thousands.
+ *
+ * A Problem runs all its kernels on the execution space instance it was
+ * made with, so problems on different partitions of the device can be
+ * solved at the same time (see BatchedTrials in tuning_playground.hpp).
+ */
+
+#include <Kokkos_Core.hpp>
+#include <cmath>
+#include <vector>
+
+namespace smoothers {
+
+using Vector = Kokkos::View<double*>;
+using Space = Kokkos::DefaultExecutionSpace;
+using Range = Kokkos::RangePolicy<Space>;
+
+struct CrsMatrix {
+    Kokkos::View<size_t*> rowMap;
+    Kokkos::View<int*> entries;
+    Kokkos::View<double*> values;
+    Vector diagonal;
+    /* rows of each colour: rows of one colour are never coupled */
+    Kokkos::View<int*> red;
+    Kokkos::View<int*> black;
+    int numRows;
+    /* upper bound on the eigenvalues of D^-1 A, from Gershgorin */
+    double lambdaMax;
+};
+
+/* shift I + L, with the 5 point Laplacian in 2D and the 7 point one in 3D */
+inline CrsMatrix laplacian(int n, int dims, double shift) {
+    int rows = (dims == 3) ? n * n * n : n * n;
+    std::vector<size_t> rowMap{0};
+    std::vector<int> entries;
+    std::vector<double> values;
+    std::vector<double> diagonal;
+    std::vector<int> red, black;
+    double centre = 2.0 * dims + shift;
+    for (int row = 0 ; row < rows ; row++) {
+        int i = row % n;
+        int j = (row / n) % n;
+        int k = (dims == 3) ? row / (n * n) : 0;
+        auto add = [&](int column, double value) {
+            entries.push_back(column);
+            values.push_back(value);
+        };
+        // columns in increasing order, so the lower part comes first
+        if (dims == 3 && k > 0) { add(row - n * n, -1.0); }
+        if (j > 0) { add(row - n, -1.0); }
+        if (i > 0) { add(row - 1, -1.0); }
+        add(row, centre);
+        if (i < n - 1) { add(row + 1, -1.0); }
+        if (j < n - 1) { add(row + n, -1.0); }
+        if (dims == 3 && k < n - 1) { add(row + n * n, -1.0); }
+        rowMap.push_back(entries.size());
+        diagonal.push_back(centre);
+        (((i + j + k) % 2 == 0) ? red : black).push_back(row);
+    }
+    CrsMatrix A;
+    A.numRows = rows;
+    A.lambdaMax = (centre + 2.0 * dims) / centre;
+    auto copy = [](auto& view, const auto& data, const char* label) {
+        using View = typename std::remove_reference<decltype(view)>::type;
+        view = View(label, data.size());
+        auto host = Kokkos::create_mirror_view(view);
+        for (size_t x = 0 ; x < data.size() ; x++) { host(x) = data[x]; }
+        Kokkos::deep_copy(view, host);
+    };
+    copy(A.rowMap, rowMap, "row map");
+    copy(A.entries, entries, "entries");
+    copy(A.values, values, "values");
+    copy(A.diagonal, diagonal, "diagonal");
+    copy(A.red, red, "red rows");
+    copy(A.black, black, "black rows");
+    return A;
+}
+
+/* r = b - A x, and returns |r|^2 */
+inline double residual(const Space& space, const CrsMatrix& A, Vector x, Vector b, Vector r) {
+    auto rowMap = A.rowMap;
+    auto entries = A.entries;
+    auto values = A.values;
+    double norm{0.0};
+    Kokkos::parallel_reduce("residual", Range(space, 0, A.numRows), KOKKOS_LAMBDA(const int row, double& sum) {
+        double ax{0.0};
+        for (size_t e = rowMap(row) ; e < rowMap(row + 1) ; e++) {
+            ax += values(e) * x(entries(e));
+        }
+        r(row) = b(row) - ax;
+        sum += r(row) * r(row);
+    }, norm);
+    return norm;
+}
+
+/* The matrix, the right hand side, and the work vectors of the smoothers */
+struct Problem {
+    Space space;
+    CrsMatrix A;
+    Vector b, x, r, d, z;
+    double tolerance;
+    /* give up on a solve after this many applications of a smoother */
+    int maxApplications;
+    Problem(int n, int dims, double _tolerance = 1.0e-4, const Space& _space = Space()) :
+        space(_space), A(laplacian(n, dims, 4.0 * dims / 29.0)), tolerance(_tolerance),
+        maxApplications(1000) {
+        b = Vector("b", A.numRows);
+        x = Vector("x", A.numRows);
+        r = Vector("r", A.numRows);
+        d = Vector("d", A.numRows);
+        z = Vector("z", A.numRows);
+        Kokkos::deep_copy(space, b, 1.0);
+        space.fence();
+    }
+    /* Solve from zero, applying the smoother 'every' times between residual
+     * checks. Returns the number of applications. */
+    template <typename Apply>
+    int solve(int every, Apply apply) {
+        Kokkos::deep_copy(space, x, 0.0);
+        double target = tolerance * tolerance * residual(space, A, x, b, r);
+        int applications{0};
+        every = every < 1 ? 1 : every;
+        while (applications < maxApplications) {
+            for (int i = 0 ; i < every ; i++) { apply(); }
+            applications += every;
+            if (residual(space, A, x, b, r) <= target) { break; }
+        }
+        space.fence();
+        return applications;
+    }
+    /* One application of the Chebyshev polynomial smoother of this degree,
+     * for the eigenvalues of D^-1 A in [lambdaMax / ratio, lambdaMax]. Every
+     * degree costs one matrix-vector product. */
+    void chebyshev(int degree, double ratio) {
+        double lambdaMax = A.lambdaMax;
+        double lambdaMin = lambdaMax / ratio;
+        double theta = 0.5 * (lambdaMax + lambdaMin);
+        double delta = 0.5 * (lambdaMax - lambdaMin);
+        double sigma = theta / delta;
+        double rho = 1.0 / sigma;
+        auto diagonal = A.diagonal;
+        auto _x = x, _r = r, _d = d;
+        residual(space, A, x, b, r);
+        Kokkos::parallel_for("chebyshev start", Range(space, 0, A.numRows), KOKKOS_LAMBDA(const int row) {
+            _d(row) = _r(row) / (theta * diagonal(row));
+        });
+        for (int k = 1 ; k <= degree ; k++) {
+            Kokkos::parallel_for("chebyshev update", Range(space, 0, A.numRows), KOKKOS_LAMBDA(const int row) {
+                _x(row) += _d(row);
+            });
+            if (k == degree) { break; }
+            residual(space, A, x, b, r);
+            double rhoNext = 1.0 / (2.0 * sigma - rho);
+            double scale = rhoNext * rho;
+            double step = 2.0 * rhoNext / delta;
+            Kokkos::parallel_for("chebyshev direction", Range(space, 0, A.numRows), KOKKOS_LAMBDA(const int row) {
+                _d(row) = scale * _d(row) + step * _r(row) / diagonal(row);
+            });
+            rho = rhoNext;
+        }
+    }
+    /* Multi-threaded Gauss-Seidel: damped sweeps over the red rows, then the
+     * black rows, each colour in parallel. */
+    void multiThreadedGaussSeidel(int sweeps, double damping) {
+        for (int s = 0 ; s < sweeps ; s++) {
+            colourSweep(A.red, damping);
+            colourSweep(A.black, damping);
+        }
+    }
+    /* Two-stage Gauss-Seidel: the triangular solve (D + L) z = r of every
+     * sweep is replaced by a few damped Jacobi iterations, which are all
+     * parallel. */
+    void twoStageGaussSeidel(int sweeps, double innerDamping, int innerIterations = 2) {
+        auto rowMap = A.rowMap;
+        auto entries = A.entries;
+        auto values = A.values;
+        auto diagonal = A.diagonal;
+        auto _x = x, _r = r, _z = z, _d = d;
+        for (int s = 0 ; s < sweeps ; s++) {
+            residual(space, A, x, b, r);
+            Kokkos::parallel_for("two-stage start", Range(space, 0, A.numRows), KOKKOS_LAMBDA(const int row) {
+                _z(row) = _r(row) / diagonal(row);
+            });
+            for (int inner = 0 ; inner < innerIterations ; inner++) {
+                Kokkos::parallel_for("two-stage inner", Range(space, 0, A.numRows), KOKKOS_LAMBDA(const int row) {
+                    double lz{0.0};
+                    for (size_t e = rowMap(row) ; e < rowMap(row + 1) && entries(e) <= row ; e++) {
+                        lz += values(e) * _z(entries(e));
+                    }
+                    _d(row) = _z(row) + innerDamping * (_r(row) - lz) / diagonal(row);
+                });
+                Kokkos::deep_copy(space, _z, _d);
+            }
+            Kokkos::parallel_for("two-stage update", Range(space, 0, A.numRows), KOKKOS_LAMBDA(const int row) {
+                _x(row) += _z(row);
+            });
+        }
+    }
+private:
+    void colourSweep(Kokkos::View<int*> rows, double damping) {
+        auto rowMap = A.rowMap;
+        auto entries = A.entries;
+        auto values = A.values;
+        auto diagonal = A.diagonal;
+        auto _x = x, _b = b;
+        Kokkos::parallel_for("gauss-seidel colour", Range(space, 0, rows.extent(0)), KOKKOS_LAMBDA(const int index) {
+            int row = rows(index);
+            double ax{0.0};
+            for (size_t e = rowMap(row) ; e < rowMap(row + 1) ; e++) {
+                ax += values(e) * _x(entries(e));
+            }
+            _x(row) += damping * (_b(row) - ax) / diagonal(row);
+        });
+    }
+};
+
+} // namespace smoothers
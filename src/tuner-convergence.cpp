@@ -0,0 +1,292 @@
+/* Convergence benchmark: how quickly each search strategy gets close to the
+ * optimum of a set of synthetic surfaces, from easy (a separable bowl) to
+ * hard (interacting, multimodal, noisy, eight dimensional).
+ *
+ * Every surface is a cost over a grid of integer levels, 1 at the optimum
+ * and scaled so that a random configuration costs about 2. By default the
+ * driver reports the cost to the tuner (simple_tuner_report_objective)
+ * instead of letting it time anything, so a run is deterministic for a
+ * given KOKKOS_TUNING_SEED; noise on the noisy surface comes from a seeded
+ * generator too. With a busy time, every trial instead spins for that many
+ * ns per unit of cost and the tuner measures it, like a real kernel.
+ *
+ * For every surface and strategy, the driver runs the search several times
+ * (each run is a new signature) and reports the median number of trials
+ * until a configuration within the tolerance of the optimum was handed out,
+ * and the mean regret (best cost handed out so far, over the optimum, minus
+ * one) after a number of trials. curves.csv, if given, gets the whole mean
+ * regret curve of every surface and strategy.
+ *
+ * usage: tuner-convergence [trials per run] [runs] [tolerance %] [busy ns]
+ *                          [curves.csv] [tuner library]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include "bench_hooks.hpp"
+
+namespace {
+
+TunerHooks hooks;
+size_t nextContext{1};
+
+/* A cost over dims integer levels, 1 + g / scale with g >= 0 and 0 at the
+ * optimum. */
+struct Surface {
+    std::string name;
+    std::vector<size_t> levels;
+    std::function<double(const int64_t*)> g;
+    std::vector<int64_t> optimum;
+    /* relative standard deviation of the noise on reported costs */
+    double noise;
+    double scale;
+    double cost(const int64_t* k) const { return 1.0 + g(k) / scale; }
+    /* scale so that the mean over random configurations is 2 */
+    void normalize(std::mt19937_64& generator) {
+        constexpr int samples{4096};
+        std::vector<int64_t> k(levels.size());
+        double total{0.0};
+        for (int s = 0 ; s < samples ; s++) {
+            for (size_t d = 0 ; d < levels.size() ; d++) {
+                k[d] = (int64_t)(generator() % levels[d]);
+            }
+            total += g(k.data());
+        }
+        scale = total > 0.0 ? total / samples : 1.0;
+    }
+};
+
+/* level k of n, spread over [lower, upper] */
+double at(int64_t k, size_t n, double lower, double upper) {
+    return lower + (upper - lower) * (double)k / (double)(n - 1);
+}
+
+std::vector<Surface> makeSurfaces(void) {
+    std::vector<Surface> surfaces;
+    // separable bowl, x in [-5,5] centred on (2, -2.5, 3.5)
+    static const double centre[3] = {2.0, -2.5, 3.5};
+    surfaces.push_back(Surface{"sphere-3", std::vector<size_t>(3, 21),
+        [](const int64_t* k) {
+            double sum{0.0};
+            for (size_t d = 0 ; d < 3 ; d++) {
+                double x = at(k[d], 21, -5, 5) - centre[d];
+                sum += x * x;
+            }
+            return sum;
+        }, std::vector<int64_t>{14, 5, 17}, 0.0, 1.0});
+    // the same with 20% noise on every measurement
+    surfaces.push_back(Surface{"noisy-sphere-3", std::vector<size_t>(3, 21),
+        surfaces.back().g, surfaces.back().optimum, 0.2, 1.0});
+    // a curved valley where the parameters interact, x in [-2,2] with 1 on the grid
+    surfaces.push_back(Surface{"rosenbrock-4", std::vector<size_t>(4, 21),
+        [](const int64_t* k) {
+            double sum{0.0};
+            for (size_t d = 0 ; d + 1 < 4 ; d++) {
+                double x = at(k[d], 21, -2, 2);
+                double y = at(k[d + 1], 21, -2, 2);
+                sum += 100.0 * (y - x * x) * (y - x * x) + (1.0 - x) * (1.0 - x);
+            }
+            return sum;
+        }, std::vector<int64_t>(4, 15), 0.0, 1.0});
+    // a local minimum at every integer, x in [-5,5] in steps of 0.25, and
+    // the global one at 1.5
+    surfaces.push_back(Surface{"rastrigin-8", std::vector<size_t>(8, 41),
+        [](const int64_t* k) {
+            double sum{0.0};
+            for (size_t d = 0 ; d < 8 ; d++) {
+                double x = at(k[d], 41, -5, 5) - 1.5;
+                sum += x * x + 10.0 * (1.0 - std::cos(2.0 * M_PI * x));
+            }
+            return sum;
+        }, std::vector<int64_t>(8, 26), 0.0, 1.0});
+    // a choice of 6 layouts, each with its own best two parameters
+    static const double penalty[6] = {0.4, 2.5, 1.5, 0.8, 0.0, 0.2};
+    static const int64_t target[6][2] = {{3, 17}, {0, 0}, {18, 18}, {6, 9}, {12, 5}, {15, 14}};
+    surfaces.push_back(Surface{"mixed-3", std::vector<size_t>{6, 21, 21},
+        [](const int64_t* k) {
+            double a = (double)(k[1] - target[k[0]][0]) / 20.0;
+            double b = (double)(k[2] - target[k[0]][1]) / 20.0;
+            return penalty[k[0]] + a * a + b * b + 2.0 * a * b * (double)(k[0] % 2);
+        }, std::vector<int64_t>{4, 12, 5}, 0.0, 1.0});
+    return surfaces;
+}
+
+/* one search: the declared outputs of a surface, run under one strategy */
+struct Instance {
+    const Surface* surface;
+    std::string strategy;
+    std::vector<Kokkos_Tools_VariableInfo> infos;
+    std::vector<std::vector<int64_t>> candidates;
+    std::vector<size_t> ids;
+    std::vector<std::string> names;
+    /* sums over the runs of the best cost so far after every trial */
+    std::vector<double> regret;
+    std::vector<size_t> hits;
+};
+
+void declare(Instance& instance, size_t& nextId) {
+    const Surface& surface = *instance.surface;
+    instance.infos.resize(surface.levels.size());
+    instance.candidates.resize(surface.levels.size());
+    for (size_t d = 0 ; d < surface.levels.size() ; d++) {
+        for (size_t k = 0 ; k < surface.levels[d] ; k++) {
+            instance.candidates[d].push_back((int64_t)k);
+        }
+        Kokkos_Tools_VariableInfo& info = instance.infos[d];
+        info = Kokkos_Tools_VariableInfo{};
+        info.type = kokkos_value_int64;
+        info.category = kokkos_value_ordinal;
+        info.valueQuantity = kokkos_value_set;
+        info.candidates = Kokkos::Tools::Experimental::make_candidate_set(
+            instance.candidates[d].size(), instance.candidates[d].data());
+        instance.ids.push_back(nextId);
+        hooks.declareOutput(instance.names[d].c_str(), nextId++, &info);
+    }
+}
+
+/* trial by trial, the cost of the configuration handed out */
+void run(Instance& instance, size_t run, size_t trials, double tolerance, double busy,
+    Kokkos_Tools_VariableInfo* inputInfo, size_t inputId, std::mt19937_64& generator) {
+    const Surface& surface = *instance.surface;
+    std::string row = surface.name + " " + instance.strategy + " run " + std::to_string(run);
+    Kokkos_Tools_VariableValue input =
+        Kokkos::Tools::Experimental::make_variable_value(inputId, row.c_str());
+    input.metadata = inputInfo;
+    std::vector<Kokkos_Tools_VariableValue> values(instance.ids.size());
+    std::vector<int64_t> k(instance.ids.size());
+    std::normal_distribution<double> normal(0.0, 1.0);
+    double optimum = surface.cost(surface.optimum.data());
+    double best{HUGE_VAL};
+    size_t hit{0};
+    for (size_t t = 0 ; t < trials ; t++) {
+        size_t id = nextContext++;
+        for (size_t d = 0 ; d < values.size() ; d++) {
+            // the application default is a fifth of the way along, away
+            // from every optimum
+            values[d] = Kokkos::Tools::Experimental::make_variable_value(instance.ids[d],
+                (int64_t)(surface.levels[d] / 5));
+            values[d].metadata = &instance.infos[d];
+        }
+        hooks.begin(id);
+        hooks.request(id, 1, &input, values.size(), values.data());
+        for (size_t d = 0 ; d < values.size() ; d++) { k[d] = values[d].value.int_value; }
+        double cost = surface.cost(k.data());
+        double measured = cost * std::max(0.05, 1.0 + surface.noise * normal(generator));
+        if (busy > 0.0) {
+            auto start = std::chrono::steady_clock::now();
+            while ((double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count() < measured * busy) { }
+        } else {
+            hooks.report(id, "cost", measured);
+        }
+        hooks.end(id);
+        best = std::min(best, cost);
+        if (hit == 0 && best <= optimum * (1.0 + tolerance)) { hit = t + 1; }
+        instance.regret[t] += best / optimum - 1.0;
+    }
+    instance.hits.push_back(hit);
+}
+
+/* the median trials to get within the tolerance, runs that never did count
+ * as never */
+std::string medianHits(std::vector<size_t> hits) {
+    for (auto& h : hits) { if (h == 0) { h = SIZE_MAX; } }
+    std::sort(hits.begin(), hits.end());
+    size_t median = hits[hits.size() / 2];
+    return median == SIZE_MAX ? std::string("never") : std::to_string(median);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t trials = argc > 1 ? strtoul(argv[1], nullptr, 10) : 500;
+    size_t runs = argc > 2 ? strtoul(argv[2], nullptr, 10) : 5;
+    double tolerance = (argc > 3 ? atof(argv[3]) : 10.0) / 100.0;
+    double busy = argc > 4 ? atof(argv[4]) : 0.0;
+    const char* curves = argc > 5 ? argv[5] : "";
+    const char* library = argc > 6 ? argv[6] : SIMPLE_TUNER_LIBRARY;
+    if (trials == 0 || runs == 0) { return 1; }
+
+    std::mt19937_64 generator(12345);
+    std::vector<Surface> surfaces = makeSurfaces();
+    for (auto& surface : surfaces) { surface.normalize(generator); }
+    const std::vector<std::string> strategies{
+        "random", "ucb1", "thompson", "nelder-mead", "coordinate"};
+
+    // every instance gets its own variables, with its strategy forced
+    std::vector<Instance> instances;
+    std::string overrides;
+    for (const auto& surface : surfaces) {
+        for (const auto& strategy : strategies) {
+            Instance instance;
+            instance.surface = &surface;
+            instance.strategy = strategy;
+            instance.regret.resize(trials, 0.0);
+            for (size_t d = 0 ; d < surface.levels.size() ; d++) {
+                instance.names.push_back(surface.name + " " + strategy + ": x" + std::to_string(d));
+                overrides += instance.names.back() + "=" + strategy + ";";
+            }
+            instances.push_back(instance);
+        }
+    }
+    setenv("KOKKOS_TUNING_STRATEGY_FOR", overrides.c_str(), 1);
+    // random search never converges, give everything the same budget
+    setenv("KOKKOS_TUNING_MAX_TRIALS", std::to_string(trials).c_str(), 0);
+
+    if (!hooks.load(library)) { return 1; }
+    Kokkos_Profiling_KokkosPDeviceInfo device{0};
+    hooks.init(0, 0, 0, &device);
+    size_t nextId{1};
+    Kokkos_Tools_VariableInfo inputInfo{};
+    inputInfo.type = kokkos_value_string;
+    inputInfo.category = kokkos_value_categorical;
+    inputInfo.valueQuantity = kokkos_value_unbounded;
+    size_t inputId = nextId++;
+    hooks.declareInput("convergence run", inputId, &inputInfo);
+    for (auto& instance : instances) {
+        declare(instance, nextId);
+        for (size_t r = 0 ; r < runs ; r++) {
+            run(instance, r, trials, tolerance, busy, &inputInfo, inputId, generator);
+        }
+    }
+    fflush(stdout);
+    hooks.finalize();
+
+    std::vector<size_t> checkpoints;
+    for (size_t t = 10 ; t < trials ; t *= 2) { checkpoints.push_back(t); }
+    checkpoints.push_back(trials);
+    printf("\nTrials to within %g%% of the optimum (median of %zu runs), and mean regret after n trials\n",
+        tolerance * 100.0, runs);
+    printf("%-16s %-12s %8s", "surface", "strategy", "trials");
+    for (auto t : checkpoints) { printf(" %9s", ("n=" + std::to_string(t)).c_str()); }
+    printf("\n");
+    for (const auto& instance : instances) {
+        printf("%-16s %-12s %8s", instance.surface->name.c_str(), instance.strategy.c_str(),
+            medianHits(instance.hits).c_str());
+        for (auto t : checkpoints) { printf(" %9.4f", instance.regret[t - 1] / (double)runs); }
+        printf("\n");
+    }
+    if (curves[0] != '\0') {
+        FILE* fp = fopen(curves, "w");
+        if (fp == nullptr) {
+            fprintf(stderr, "Unable to write %s\n", curves);
+            return 1;
+        }
+        fprintf(fp, "surface,strategy,trial,regret\n");
+        for (const auto& instance : instances) {
+            for (size_t t = 0 ; t < trials ; t++) {
+                fprintf(fp, "%s,%s,%zu,%g\n", instance.surface->name.c_str(),
+                    instance.strategy.c_str(), t + 1, instance.regret[t] / (double)runs);
+            }
+        }
+        fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+/* Microbenchmark of what the tuner costs per tuned region: ns per call of
+ * declare_output_type, begin_context, request_values and end_context, for
+ * requests with 1, 10 and 100 output variables, on one thread and on many.
+ *
+ * The tuner library is loaded and called directly (see bench_hooks.hpp), so
+ * the numbers are the tool's own cost. Every row gets its own search: the
+ * first KOKKOS_TUNING_MAX_TRIALS contexts of it (default 1000 here) are the
+ * search, the rest only take the fast path of a converged search.
+ *
+ * usage: tuner-overhead [contexts per thread] [threads] [tuner library]
+ *
+ * Build with -DCMAKE_BUILD_TYPE=Release -DSIMPLE_TUNER_SANITIZE=OFF or the
+ * numbers mean nothing, see bench.sh.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench_hooks.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+TunerHooks hooks;
+std::atomic<size_t> nextContext{1};
+/* what a pair of clock reads costs, taken off every timed call */
+double clockOverhead{0.0};
+
+double elapsed(clock_type::time_point start, clock_type::time_point stop) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+}
+
+void measureClock(void) {
+    constexpr int reads{100000};
+    double total{0.0};
+    for (int i = 0 ; i < reads ; i++) {
+        auto start = clock_type::now();
+        total += elapsed(start, clock_type::now());
+    }
+    clockOverhead = total / reads;
+}
+
+/* ns per call of each hook */
+struct Costs {
+    double begin{0.0};
+    double request{0.0};
+    double end{0.0};
+    size_t calls{0};
+    void add(const Costs& other) {
+        begin += other.begin;
+        request += other.request;
+        end += other.end;
+        calls += other.calls;
+    }
+    double perCall(double total) const {
+        double ns = calls == 0 ? 0.0 : total / (double)calls - clockOverhead;
+        return ns > 0.0 ? ns : 0.0;
+    }
+};
+
+/* the output variables of one row, all categorical choices of 4 */
+struct Outputs {
+    std::vector<Kokkos_Tools_VariableInfo> infos;
+    std::vector<size_t> ids;
+};
+
+/* declare the outputs of a row, and return ns per declaration */
+double declare(Outputs& outputs, size_t count, size_t& nextId) {
+    static int64_t candidates[4] = {0, 1, 2, 3};
+    outputs.infos.resize(count);
+    for (auto& info : outputs.infos) {
+        info = Kokkos_Tools_VariableInfo{};
+        info.type = kokkos_value_int64;
+        info.category = kokkos_value_categorical;
+        info.valueQuantity = kokkos_value_set;
+        info.candidates = Kokkos::Tools::Experimental::make_candidate_set(4, candidates);
+    }
+    std::vector<std::string> names;
+    for (size_t i = 0 ; i < count ; i++) {
+        names.push_back("bench " + std::to_string(count) + ": " + std::to_string(i));
+    }
+    auto start = clock_type::now();
+    for (size_t i = 0 ; i < count ; i++) {
+        outputs.ids.push_back(nextId);
+        hooks.declareOutput(names[i].c_str(), nextId++, &outputs.infos[i]);
+    }
+    return elapsed(start, clock_type::now()) / (double)count;
+}
+
+/* one thread's share of a row: contexts begin, request and end */
+void run(Outputs& outputs, Kokkos_Tools_VariableInfo* inputInfo, size_t inputId,
+    const std::string& row, size_t contexts, Costs& costs) {
+    Kokkos_Tools_VariableValue input =
+        Kokkos::Tools::Experimental::make_variable_value(inputId, row.c_str());
+    input.metadata = inputInfo;
+    std::vector<Kokkos_Tools_VariableValue> values(outputs.ids.size());
+    for (size_t i = 0 ; i < values.size() ; i++) {
+        values[i] = Kokkos::Tools::Experimental::make_variable_value(outputs.ids[i], int64_t(0));
+        values[i].metadata = &outputs.infos[i];
+    }
+    for (size_t c = 0 ; c < contexts ; c++) {
+        size_t id = nextContext.fetch_add(1, std::memory_order_relaxed);
+        auto t0 = clock_type::now();
+        hooks.begin(id);
+        auto t1 = clock_type::now();
+        hooks.request(id, 1, &input, values.size(), values.data());
+        auto t2 = clock_type::now();
+        hooks.end(id);
+        auto t3 = clock_type::now();
+        costs.begin += elapsed(t0, t1);
+        costs.request += elapsed(t1, t2);
+        costs.end += elapsed(t2, t3);
+        costs.calls++;
+    }
+}
+
+Costs runThreads(Outputs& outputs, Kokkos_Tools_VariableInfo* inputInfo,
+    size_t inputId, const std::string& row, size_t contexts, size_t threads) {
+    std::vector<Costs> perThread(threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 0 ; t < threads ; t++) {
+        workers.emplace_back(run, std::ref(outputs), inputInfo, inputId, std::cref(row),
+            contexts, std::ref(perThread[t]));
+    }
+    Costs total;
+    for (size_t t = 0 ; t < threads ; t++) {
+        workers[t].join();
+        total.add(perThread[t]);
+    }
+    return total;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t contexts = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    size_t threads = argc > 2 ? strtoul(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+    const char* library = argc > 3 ? argv[3] : SIMPLE_TUNER_LIBRARY;
+    if (threads == 0) { threads = 1; }
+    // a search that ends, so the fast path gets measured too
+    setenv("KOKKOS_TUNING_MAX_TRIALS", "1000", 0);
+    size_t trials = strtoul(getenv("KOKKOS_TUNING_MAX_TRIALS"), nullptr, 10);
+    if (!hooks.load(library)) { return 1; }
+    measureClock();
+    Kokkos_Profiling_KokkosPDeviceInfo device{0};
+    hooks.init(0, 0, 0, &device);
+
+    size_t nextId{1};
+    Kokkos_Tools_VariableInfo inputInfo{};
+    inputInfo.type = kokkos_value_string;
+    inputInfo.category = kokkos_value_categorical;
+    inputInfo.valueQuantity = kokkos_value_unbounded;
+    size_t inputId = nextId++;
+    hooks.declareInput("bench row", inputId, &inputInfo);
+
+    printf("%-20s %8s %8s %16s %16s\n", "hook", "outputs", "threads",
+        "searching ns/op", "converged ns/op");
+    std::vector<size_t> counts{1, 10, 100};
+    std::vector<size_t> threadCounts{1};
+    if (threads > 1) { threadCounts.push_back(threads); }
+    for (auto count : counts) {
+        Outputs outputs;
+        double ns = declare(outputs, count, nextId);
+        printf("%-20s %8zu %8d %16.1f %16s\n", "declare_output_type", count, 1, ns, "-");
+        for (auto t : threadCounts) {
+            std::string row = std::to_string(count) + " outputs, " + std::to_string(t) + " threads";
+            // the search, then the converged search
+            Costs searching = runThreads(outputs, &inputInfo, inputId, row, (trials + t - 1) / t, t);
+            Costs converged = runThreads(outputs, &inputInfo, inputId, row, contexts, t);
+            printf("%-20s %8zu %8zu %16.1f %16.1f\n", "begin_context", count, t,
+                searching.perCall(searching.begin), converged.perCall(converged.begin));
+            printf("%-20s %8zu %8zu %16.1f %16.1f\n", "request_values", count, t,
+                searching.perCall(searching.request), converged.perCall(converged.request));
+            printf("%-20s %8zu %8zu %16.1f %16.1f\n", "end_context", count, t,
+                searching.perCall(searching.end), converged.perCall(converged.end));
+        }
+    }
+    fflush(stdout);
+    hooks.finalize();
+    return 0;
+}
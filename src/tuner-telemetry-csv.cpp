@@ -0,0 +1,204 @@
+/* Turns a KOKKOS_TUNING_TELEMETRY file (see tuner_telemetry.hpp) into CSV,
+ * one file per search since every search has its own outputs:
+ * <prefix>-<n>.csv for the n-th search in the file, with the columns
+ *
+ *   timestamp_ns,context,thread,cost,duration,measured,exploit,reported,
+ *   nested, and then one column per output (the first eight)
+ *
+ * and prints which search went where. String outputs are written as their
+ * candidate. A file that was cut short (the run crashed, say) is read up to
+ * the last whole record.
+ *
+ * usage: tuner-telemetry-csv telemetry.bin [prefix]
+ *        (the prefix defaults to the input file without its extension)
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "tuner_telemetry.hpp"
+
+namespace {
+
+/* the Kokkos value types, as they are in the Search records */
+enum ValueType : uint32_t { TypeDouble = 0, TypeInt64 = 1, TypeString = 2 };
+
+struct Output {
+    uint32_t type;
+    std::string name;
+    std::vector<std::string> strings;
+};
+
+struct SearchFile {
+    FILE* fp;
+    std::vector<Output> outputs;
+};
+
+/* Reads the fields of a record, and remembers if it ran out. */
+class Reader {
+public:
+    Reader(const std::vector<char>& data) : data_(data), offset_(0), ok_(true) { }
+    template<typename T> T get(void) {
+        T value{};
+        if (offset_ + sizeof(T) > data_.size()) { ok_ = false; return value; }
+        std::memcpy(&value, data_.data() + offset_, sizeof(T));
+        offset_ += sizeof(T);
+        return value;
+    }
+    std::string string(void) {
+        uint32_t length = get<uint32_t>();
+        if (!ok_ || offset_ + length > data_.size()) { ok_ = false; return std::string(); }
+        std::string str(data_.data() + offset_, length);
+        offset_ += length;
+        return str;
+    }
+    bool ok(void) const { return ok_; }
+private:
+    const std::vector<char>& data_;
+    size_t offset_;
+    bool ok_;
+};
+
+/* CSV quoting, for names and string values */
+std::string quote(const std::string& str) {
+    if (str.find_first_of(",\"\n") == std::string::npos) { return str; }
+    std::string quoted{"\""};
+    for (char c : str) {
+        if (c == '"') { quoted += '"'; }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+void writeValue(FILE* fp, const Output& output, uint64_t bits) {
+    if (output.type == TypeDouble) {
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        fprintf(fp, ",%.17g", value);
+    } else if (output.type == TypeString) {
+        fprintf(fp, ",%s", bits < output.strings.size() ?
+            quote(output.strings[bits]).c_str() : "");
+    } else {
+        fprintf(fp, ",%" PRId64, (int64_t)bits);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s telemetry.bin [prefix]\n", argv[0]);
+        return 1;
+    }
+    std::string path(argv[1]);
+    // the extension of the file name, not of a directory
+    size_t slash = path.rfind('/');
+    size_t dot = path.rfind('.');
+    size_t base = slash == std::string::npos ? 0 : slash + 1;
+    if (dot == std::string::npos || dot <= base) { dot = std::string::npos; }
+    std::string prefix = argc > 2 ? std::string(argv[2]) : path.substr(0, dot);
+    FILE* in = fopen(path.c_str(), "rb");
+    if (in == nullptr) {
+        fprintf(stderr, "Unable to read %s\n", path.c_str());
+        return 1;
+    }
+    char magic[8];
+    uint32_t version{0};
+    uint32_t rowSize{0};
+    if (fread(magic, 8, 1, in) != 1 || std::memcmp(magic, "KTTELEM1", 8) != 0 ||
+        fread(&version, sizeof(version), 1, in) != 1 ||
+        fread(&rowSize, sizeof(rowSize), 1, in) != 1 ||
+        version != TelemetryWriter::version || rowSize != sizeof(TelemetryWriter::Row)) {
+        fprintf(stderr, "%s is not a telemetry file of version %u\n", path.c_str(),
+            TelemetryWriter::version);
+        fclose(in);
+        return 1;
+    }
+    std::map<uint64_t,SearchFile> searches;
+    size_t rows{0};
+    size_t unknown{0};
+    uint64_t dropped{0};
+    std::vector<char> data;
+    for (;;) {
+        uint32_t head[2];
+        if (fread(head, sizeof(head), 1, in) != 1 || head[1] < sizeof(head)) { break; }
+        data.resize(head[1]);
+        std::memcpy(data.data(), head, sizeof(head));
+        if (fread(data.data() + sizeof(head), head[1] - sizeof(head), 1, in) != 1 &&
+            head[1] > sizeof(head)) {
+            break;
+        }
+        if (head[0] == (uint32_t)TelemetryWriter::Kind::Row && head[1] == sizeof(TelemetryWriter::Row)) {
+            TelemetryWriter::Row row;
+            std::memcpy(&row, data.data(), sizeof(row));
+            auto iter = searches.find(row.signature);
+            if (iter == searches.end()) { unknown++; continue; }
+            SearchFile& search = iter->second;
+            fprintf(search.fp, "%" PRIu64 ",%" PRIu64 ",%u,%.17g,%" PRIu64 ",%d,%d,%d,%d",
+                row.timestamp, row.contextId, row.thread, row.cost, row.duration,
+                (row.flags & TelemetryWriter::Measured) != 0,
+                (row.flags & TelemetryWriter::Exploit) != 0,
+                (row.flags & TelemetryWriter::Reported) != 0,
+                (row.flags & TelemetryWriter::Nested) != 0);
+            for (size_t i = 0 ; i < search.outputs.size() ; i++) {
+                if (i < row.numValues) {
+                    writeValue(search.fp, search.outputs[i], row.values[i]);
+                } else {
+                    fprintf(search.fp, ",");
+                }
+            }
+            fprintf(search.fp, "\n");
+            rows++;
+        } else if (head[0] == (uint32_t)TelemetryWriter::Kind::Search) {
+            Reader reader(data);
+            reader.get<uint64_t>();
+            uint64_t signature = reader.get<uint64_t>();
+            uint32_t numOutputs = reader.get<uint32_t>();
+            std::string description = reader.string();
+            std::vector<Output> outputs;
+            for (uint32_t i = 0 ; reader.ok() && i < numOutputs ; i++) {
+                Output output;
+                output.type = reader.get<uint32_t>();
+                output.name = reader.string();
+                uint32_t numStrings = reader.get<uint32_t>();
+                for (uint32_t s = 0 ; reader.ok() && s < numStrings ; s++) {
+                    output.strings.push_back(reader.string());
+                }
+                outputs.push_back(output);
+            }
+            if (!reader.ok() || searches.count(signature) > 0) { continue; }
+            std::string name = prefix + "-" + std::to_string(searches.size()) + ".csv";
+            FILE* fp = fopen(name.c_str(), "w");
+            if (fp == nullptr) {
+                fprintf(stderr, "Unable to write %s\n", name.c_str());
+                continue;
+            }
+            if (outputs.size() > TelemetryWriter::maxValues) {
+                outputs.resize(TelemetryWriter::maxValues);
+            }
+            fprintf(fp, "timestamp_ns,context,thread,cost,duration,measured,exploit,reported,nested");
+            for (const auto& output : outputs) {
+                fprintf(fp, ",%s", quote(output.name).c_str());
+            }
+            fprintf(fp, "\n");
+            searches[signature] = SearchFile{fp, outputs};
+            printf("%s: %s\n", name.c_str(), description.c_str());
+        } else if (head[0] == (uint32_t)TelemetryWriter::Kind::Dropped) {
+            Reader reader(data);
+            reader.get<uint64_t>();
+            dropped = reader.get<uint64_t>();
+        }
+    }
+    fclose(in);
+    for (auto& entry : searches) {
+        fclose(entry.second.fp);
+    }
+    printf("%zu rows of %zu searches", rows, searches.size());
+    if (dropped > 0) { printf(", %" PRIu64 " rows were dropped during the run", dropped); }
+    if (unknown > 0) { printf(", %zu rows of searches that weren't described", unknown); }
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+/* Lock-free building blocks for running the search strategies on a
+ * background thread (KOKKOS_TUNING_ASYNC), so that the hooks only move
+ * small records in and out of queues:
+ *   - BoundedQueue carries measurements from end_context to the worker,
+ *   - ReadySlots holds the configurations the worker has proposed ahead of
+ *     time, for request_values to take.
+ * Neither allocates after construction, and both refuse (return false)
+ * instead of blocking when they are full or empty.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/* Dmitry Vyukov's bounded multi-producer multi-consumer queue. Every cell
+ * has a sequence number that says whose turn it is, so producers and
+ * consumers only contend on their own end of the queue. N must be a power
+ * of two. */
+template <typename T, size_t N>
+class BoundedQueue {
+    static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+public:
+    BoundedQueue() : enqueue_(0), dequeue_(0) {
+        for (size_t i = 0 ; i < N ; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    bool push(const T& data) {
+        Cell* cell;
+        size_t pos = enqueue_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & (N - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_.compare_exchange_weak(pos, pos + 1,
+                    std::memory_order_relaxed)) { break; }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = data;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    bool pop(T& data) {
+        Cell* cell;
+        size_t pos = dequeue_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & (N - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_.compare_exchange_weak(pos, pos + 1,
+                    std::memory_order_relaxed)) { break; }
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = dequeue_.load(std::memory_order_relaxed);
+            }
+        }
+        data = cell->data;
+        cell->sequence.store(pos + N, std::memory_order_release);
+        return true;
+    }
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+    Cell cells_[N];
+    alignas(64) std::atomic<size_t> enqueue_;
+    alignas(64) std::atomic<size_t> dequeue_;
+};
+
+/* A handful of precomputed values with one producer (the worker) and any
+ * number of consumers. Each slot goes Empty -> Ready when the producer has
+ * filled it, and Ready -> Taken -> Empty when a consumer copies it out. */
+template <typename T, size_t N>
+class ReadySlots {
+public:
+    ReadySlots() {
+        for (auto& slot : slots_) { slot.state.store(Empty, std::memory_order_relaxed); }
+    }
+    /* producer only: an empty slot to fill, or nullptr */
+    T* claim(size_t& slot) {
+        for (slot = 0 ; slot < N ; slot++) {
+            if (slots_[slot].state.load(std::memory_order_acquire) == Empty) {
+                return &(slots_[slot].data);
+            }
+        }
+        return nullptr;
+    }
+    /* producer only: the slot filled by claim() is ready */
+    void publish(size_t slot) {
+        slots_[slot].state.store(Ready, std::memory_order_release);
+    }
+    bool take(T& data) {
+        for (auto& slot : slots_) {
+            uint32_t expected = Ready;
+            if (slot.state.load(std::memory_order_relaxed) == Ready &&
+                slot.state.compare_exchange_strong(expected, Taken,
+                    std::memory_order_acquire)) {
+                data = slot.data;
+                slot.state.store(Empty, std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    enum : uint32_t { Empty, Ready, Taken };
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> state;
+        T data;
+    };
+    Slot slots_[N];
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+/* Multi-armed bandit search over a discrete set of candidates, used by the
+ * simple tuner for categorical choices like "which implementation is the
+ * fastest". Each arm is one candidate index. Rewards are durations, so lower
+ * is better.
+ *
+ * The arm statistics are discounted on every update, so old observations
+ * fade and the bandit will notice if the fastest arm changes during a run.
+ *
+ * Plays that have been handed out but not measured yet (several contexts of
+ * a batch running at once) count as plays when choosing, so a batch spreads
+ * over the arms instead of playing the same one several times.
+ *
+ * Successive halving (BanditPolicy::Halving) is for a choice whose cost
+ * improves as it is played, like an implementation whose own parameters
+ * are tuned in inner contexts: rather than keep every arm in play, it gives
+ * the arms equal rounds of plays out of a fixed budget, and after each
+ * round drops the slower half by their costs in that round. The plays the
+ * losers would have had go to the survivors (and to tuning their inner
+ * parameters), and after log2(arms) rounds one arm is left.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "tuner_random.hpp"
+
+enum class BanditPolicy { UCB1, Thompson, Halving };
+
+class Bandit {
+public:
+    /* the first round of plays starts at arm first, so that bandits on
+     * different ranks don't all try the same arms first */
+    /* (budget is the total number of plays for Halving, 0 for
+     * defaultRoundPlays plays per arm and round) */
+    Bandit(size_t numArms, BanditPolicy policy, double discount, size_t first = 0,
+        size_t budget = 0) :
+        arms_(numArms), pending_(numArms, 0), policy_(policy), discount_(discount), total_(0.0),
+        first_(numArms > 0 ? first % numArms : 0), alive_(numArms, true),
+        numAlive_(numArms), round_(0), rounds_(0), budget_(budget),
+        roundCount_(numArms, 0), roundSum_(numArms, 0.0) {
+        while (((size_t)1 << rounds_) < numArms) { rounds_++; }
+        if (budget_ == 0) { budget_ = defaultRoundPlays * numArms * rounds_; }
+    }
+    /* play this arm first, if nothing has been played yet */
+    void startAt(size_t arm) {
+        if (total_ == 0.0 && arm < arms_.size()) { first_ = arm; }
+    }
+    /* pick the next arm to play, and count it as pending until update() */
+    size_t choose(void) {
+        size_t arm = pick();
+        pending_[arm]++;
+        return arm;
+    }
+    /* a play that won't be measured after all */
+    void release(size_t arm) {
+        if (arm < arms_.size() && pending_[arm] > 0) { pending_[arm]--; }
+    }
+    /* credit a measurement to an arm */
+    void update(size_t arm, double duration) {
+        if (arm >= arms_.size()) { return; }
+        release(arm);
+        if (policy_ == BanditPolicy::Halving) { updateRound(arm, duration); }
+        for (auto& a : arms_) {
+            a.count *= discount_;
+            a.sum *= discount_;
+            a.sumsq *= discount_;
+        }
+        total_ = total_ * discount_ + 1.0;
+        arms_[arm].count += 1.0;
+        arms_[arm].sum += duration;
+        arms_[arm].sumsq += duration * duration;
+    }
+    size_t numArms(void) const { return arms_.size(); }
+    /* Have we seen enough to stop? Every other arm has to be clearly slower
+     * than the fastest one (z standard errors apart), or so close to it that
+     * it doesn't matter (within tolerance, as a fraction of the mean). */
+    bool converged(double tolerance = 0.02, double z = 2.0) const {
+        if (policy_ == BanditPolicy::Halving) { return numAlive_ <= 1; }
+        size_t fastest = 0;
+        for (size_t i = 0 ; i < arms_.size() ; i++) {
+            if (arms_[i].count < 2.0) { return false; }
+            if (mean(i) < mean(fastest)) { fastest = i; }
+        }
+        double upper = mean(fastest) + z * standardError(fastest);
+        for (size_t i = 0 ; i < arms_.size() ; i++) {
+            if (i == fastest) { continue; }
+            if (mean(i) - mean(fastest) <= tolerance * mean(fastest) &&
+                arms_[i].count >= 5.0) { continue; }
+            if (mean(i) - z * standardError(i) <= upper) { return false; }
+        }
+        return true;
+    }
+    bool halving(void) const { return policy_ == BanditPolicy::Halving; }
+    /* where successive halving is: the round (of rounds()), and the arms
+     * still in play */
+    size_t round(void) const { return round_; }
+    size_t rounds(void) const { return rounds_; }
+    bool alive(size_t arm) const { return alive_[arm]; }
+    /* the arm halving kept, once it has converged */
+    size_t survivor(void) const {
+        for (size_t i = 0 ; i < arms_.size() ; i++) {
+            if (alive_[i]) { return i; }
+        }
+        return 0;
+    }
+    /* effective (discounted) number of plays of an arm */
+    double count(size_t arm) const { return arms_[arm].count; }
+    double mean(size_t arm) const {
+        if (arms_[arm].count == 0.0) { return 0.0; }
+        return arms_[arm].sum / arms_[arm].count;
+    }
+private:
+    struct Arm {
+        double count{0.0};
+        double sum{0.0};
+        double sumsq{0.0};
+    };
+    /* plays per arm and round if there is no budget, before halving */
+    static constexpr size_t defaultRoundPlays{8};
+    std::vector<Arm> arms_;
+    std::vector<size_t> pending_;
+    BanditPolicy policy_;
+    double discount_;
+    double total_;
+    size_t first_;
+    /* successive halving: the arms still in play, and this round's plays */
+    std::vector<bool> alive_;
+    size_t numAlive_;
+    size_t round_;
+    size_t rounds_;
+    size_t budget_;
+    std::vector<size_t> roundCount_;
+    std::vector<double> roundSum_;
+    size_t pick(void) {
+        if (policy_ == BanditPolicy::Halving) {
+            return chooseHalving();
+        }
+        // play every arm once before trusting any of the statistics
+        for (size_t k = 0 ; k < arms_.size() ; k++) {
+            size_t i = (first_ + k) % arms_.size();
+            if (arms_[i].count == 0.0 && pending_[i] == 0) { return i; }
+        }
+        // everything is pending, go on with one of them
+        for (size_t k = 0 ; k < arms_.size() ; k++) {
+            size_t i = (first_ + k) % arms_.size();
+            if (arms_[i].count == 0.0) { return i; }
+        }
+        if (policy_ == BanditPolicy::Thompson) {
+            return chooseThompson();
+        }
+        return chooseUCB1();
+    }
+    /* plays, counting the pending ones */
+    double plays(size_t arm) const { return arms_[arm].count + (double)pending_[arm]; }
+    double standardError(size_t arm) const {
+        return std::sqrt(variance(arm) / arms_[arm].count);
+    }
+    double variance(size_t arm) const {
+        double m = mean(arm);
+        double v = (arms_[arm].sumsq / arms_[arm].count) - (m * m);
+        return v < 0.0 ? 0.0 : v;
+    }
+    /* UCB1 on normalized rewards: the fastest mean scores 1.0, an arm
+     * twice as slow scores 0.5, plus the usual exploration bonus. */
+    size_t chooseUCB1(void) {
+        double fastest = mean(0);
+        for (size_t i = 1 ; i < arms_.size() ; i++) {
+            if (mean(i) < fastest) { fastest = mean(i); }
+        }
+        double total = total_;
+        for (auto p : pending_) { total += (double)p; }
+        double logTotal = std::log(total > 1.0 ? total : 1.0);
+        size_t best = 0;
+        double bestScore = -1.0;
+        for (size_t i = 0 ; i < arms_.size() ; i++) {
+            double reward = mean(i) > 0.0 ? fastest / mean(i) : 1.0;
+            double score = reward + std::sqrt(2.0 * logTotal / plays(i));
+            if (score > bestScore) {
+                bestScore = score;
+                best = i;
+            }
+        }
+        return best;
+    }
+    /* Every round gets an equal share of the budget, split between the
+     * arms still in play (and at least one play each). */
+    size_t roundPlays(void) const {
+        size_t share = budget_ / ((rounds_ > 0 ? rounds_ : 1) * (numAlive_ > 0 ? numAlive_ : 1));
+        return share > 0 ? share : 1;
+    }
+    /* the arm in play with the fewest plays this round, pending ones too */
+    size_t chooseHalving(void) {
+        size_t best = first_;
+        size_t fewest = SIZE_MAX;
+        for (size_t k = 0 ; k < arms_.size() ; k++) {
+            size_t i = (first_ + k) % arms_.size();
+            if (!alive_[i]) { continue; }
+            size_t plays = roundCount_[i] + pending_[i];
+            if (plays < fewest) {
+                fewest = plays;
+                best = i;
+            }
+        }
+        return best;
+    }
+    /* Once every arm in play has had its plays, keep the faster half (by
+     * the mean cost of the round) for the next round. */
+    void updateRound(size_t arm, double duration) {
+        // plays of arms that were dropped while they were running
+        if (!alive_[arm] || numAlive_ <= 1) { return; }
+        roundCount_[arm]++;
+        roundSum_[arm] += duration;
+        size_t plays = roundPlays();
+        for (size_t i = 0 ; i < arms_.size() ; i++) {
+            if (alive_[i] && roundCount_[i] < plays) { return; }
+        }
+        std::vector<std::pair<double,size_t>> ranked;
+        for (size_t i = 0 ; i < arms_.size() ; i++) {
+            if (alive_[i]) { ranked.emplace_back(roundSum_[i] / (double)roundCount_[i], i); }
+        }
+        std::sort(ranked.begin(), ranked.end());
+        size_t keep = (numAlive_ + 1) / 2;
+        for (size_t r = keep ; r < ranked.size() ; r++) {
+            alive_[ranked[r].second] = false;
+        }
+        numAlive_ = keep;
+        round_++;
+        std::fill(roundCount_.begin(), roundCount_.end(), 0);
+        std::fill(roundSum_.begin(), roundSum_.end(), 0.0);
+    }
+    /* Gaussian Thompson sampling: draw a plausible mean for every arm from
+     * its posterior, and play the arm with the fastest draw. */
+    size_t chooseThompson(void) {
+        size_t best = 0;
+        double bestDraw = 0.0;
+        for (size_t i = 0 ; i < arms_.size() ; i++) {
+            double m = mean(i);
+            // don't let a couple of identical samples collapse the posterior
+            double sd = std::sqrt(variance(i));
+            if (sd < 0.05 * m) { sd = 0.05 * m; }
+            double draw = m + (sd / std::sqrt(plays(i))) *
+                TunerRandom::get().standardNormal();
+            if (i == 0 || draw < bestDraw) {
+                bestDraw = draw;
+                best = i;
+            }
+        }
+        return best;
+    }
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+/* Buckets for unbounded numeric inputs (problem sizes and the like), so
+ * that nearby values share a search instead of every value getting its own.
+ *
+ * Buckets are log-scale: with b buckets per octave, bucket k of the
+ * positive values covers [2^(k/b), 2^((k+1)/b)), and negative values mirror
+ * that. The bucket of a value is a pure function of the value, so it is the
+ * same in every run and can go in the search key (and the tuning cache).
+ *
+ * The range is fixed: maxBins buckets on either side of zero, centred on a
+ * magnitude of 1, and magnitudes beyond it go into the outermost bucket of
+ * their side. With the defaults (4 per octave, 256) that is 2^-32 to 2^32.
+ *
+ * The bins themselves only keep statistics for the report. Every thread
+ * counts into its own, so the lookup never waits on another thread, and
+ * the report merges them.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class Bin {
+public:
+    Bin(int64_t _key, double value) :
+        key(_key), total(value), min(value), max(value), count(1) { }
+    int64_t key;
+    double total;
+    double min;
+    double max;
+    size_t count;
+    double mean(void) const { return total / (double)count; }
+    void add(double value) {
+        count++;
+        total += value;
+        if (value < min) min = value;
+        if (value > max) max = value;
+    }
+    std::string getName() const {
+        std::stringstream ss;
+        ss << "bin_" << key;
+        return ss.str();
+    }
+};
+
+class BinIndex {
+public:
+    BinIndex(size_t perOctave, size_t maxBins) :
+        perOctave_(perOctave > 0 ? perOctave : 1),
+        limit_(maxBins > 1 ? (int64_t)(maxBins / 2) : 1) {
+        for (auto& shard : shards_) { shard.store(nullptr, std::memory_order_relaxed); }
+    }
+    ~BinIndex() {
+        for (auto& shard : shards_) { delete shard.load(std::memory_order_relaxed); }
+    }
+    /* Buckets are numbered so that their order is the order of the values:
+     * 0 is zero, positive values are above offset, negative ones below
+     * -offset. Magnitudes beyond the range go into its first or last
+     * bucket. */
+    int64_t keyFor(double value) const {
+        if (value == 0.0 || std::isnan(value)) { return 0; }
+        int64_t k = limit_ - 1;
+        if (std::isfinite(value)) {
+            double exponent = std::floor(std::log2(std::fabs(value)) * (double)perOctave_);
+            k = (int64_t)std::max((double)-limit_, std::min((double)(limit_ - 1), exponent));
+        }
+        return value > 0.0 ? offset + k : -(offset + k);
+    }
+    /* the values a bucket covers, [lower, upper) for positive buckets and
+     * (lower, upper] for negative ones */
+    double lower(int64_t key) const {
+        if (key == 0) { return 0.0; }
+        if (key < 0) { return -magnitude(-key + 1); }
+        return magnitude(key);
+    }
+    double upper(int64_t key) const {
+        if (key == 0) { return 0.0; }
+        if (key < 0) { return -magnitude(-key); }
+        return magnitude(key + 1);
+    }
+    /* Count a value in the statistics of its bin, and return the bin's key */
+    int64_t add(double value) {
+        int64_t key = keyFor(value);
+        Shard& mine = shard();
+        std::lock_guard<std::mutex> guard(mine.mutex);
+        mine.add(key, value);
+        return key;
+    }
+    size_t size(void) {
+        return snapshot().size();
+    }
+    /* the bins of every thread, merged */
+    std::vector<Bin> snapshot(void) {
+        Shard merged;
+        for (auto& slot : shards_) {
+            Shard* shard = slot.load(std::memory_order_acquire);
+            if (shard == nullptr) { continue; }
+            std::lock_guard<std::mutex> guard(shard->mutex);
+            for (const auto& b : shard->bins) { merged.merge(b); }
+        }
+        return merged.bins;
+    }
+private:
+    static constexpr int64_t offset{int64_t{1} << 32};
+    /* threads share a shard only when there are more of them than this */
+    static constexpr size_t numShards{64};
+    /* The statistics one thread collected, sorted by key. The lock is only
+     * ever contended by a report. */
+    struct Shard {
+        std::mutex mutex;
+        std::vector<Bin> bins;
+        std::vector<Bin>::iterator find(int64_t key) {
+            return std::lower_bound(bins.begin(), bins.end(), key,
+                [](const Bin& b, int64_t k) { return b.key < k; });
+        }
+        void add(int64_t key, double value) {
+            auto iter = find(key);
+            if (iter != bins.end() && iter->key == key) {
+                iter->add(value);
+            } else {
+                bins.insert(iter, Bin(key, value));
+            }
+        }
+        void merge(const Bin& other) {
+            auto iter = find(other.key);
+            if (iter == bins.end() || iter->key != other.key) {
+                bins.insert(iter, other);
+                return;
+            }
+            iter->count += other.count;
+            iter->total += other.total;
+            iter->min = std::min(iter->min, other.min);
+            iter->max = std::max(iter->max, other.max);
+        }
+    };
+    size_t perOctave_;
+    /* the exponents (in buckets) go from -limit_ to limit_ - 1 */
+    int64_t limit_;
+    std::atomic<Shard*> shards_[numShards];
+    double magnitude(int64_t key) const {
+        return std::exp2((double)(key - offset) / (double)perOctave_);
+    }
+    Shard& shard(void) {
+        static std::atomic<size_t> threads{0};
+        static thread_local size_t number{threads.fetch_add(1, std::memory_order_relaxed)};
+        std::atomic<Shard*>& slot = shards_[number % numShards];
+        Shard* shard = slot.load(std::memory_order_acquire);
+        if (shard == nullptr) {
+            Shard* fresh = new Shard;
+            if (slot.compare_exchange_strong(shard, fresh, std::memory_order_acq_rel)) {
+                shard = fresh;
+            } else {
+                delete fresh;
+            }
+        }
+        return *shard;
+    }
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+/* Persistent tuning results for the simple tuner, so that a run can start
+ * from what earlier runs learned. Include this after Kokkos_Core.hpp, it
+ * needs the tuning value types.
+ *
+ * The file is a small header followed by one record per search, and is
+ * read in one go at startup:
+ *
+ *   header:  char magic[8] = "KTUNECH1", uint32_t version, uint32_t count
+ *   record:  uint64_t signature      hash of input values and output names
+ *            uint64_t trials         how many trials the search took
+ *            double bestCost         of the best configuration (version 1
+ *                                    had a uint64_t time in ns here)
+ *            uint32_t numOutputs
+ *            uint32_t converged      1 if the search had stopped
+ *            outputs[numOutputs]:
+ *              uint64_t nameHash     Variable::nameHash of the output
+ *              ValueUnion value      the best value for that output
+ *
+ * Records are written in the byte order of the machine that wrote them.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class TuningCache {
+public:
+    static constexpr uint32_t version{2};
+    struct Output {
+        uint64_t nameHash;
+        union Kokkos_Tools_VariableValue_ValueUnion value;
+    };
+    struct Header {
+        uint64_t signature;
+        uint64_t trials;
+        double bestCost;
+        uint32_t numOutputs;
+        uint32_t converged;
+    };
+    struct Record {
+        Header header;
+        std::vector<Output> outputs;
+    };
+    /* returns the number of records read, a missing file is not an error */
+    size_t load(const std::string& path) {
+        FILE* fp = fopen(path.c_str(), "rb");
+        if (fp == nullptr) { return 0; }
+        // slurp the whole thing, then parse from memory
+        std::vector<char> buffer;
+        char chunk[65536];
+        size_t got;
+        while ((got = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+            buffer.insert(buffer.end(), chunk, chunk + got);
+        }
+        fclose(fp);
+        size_t offset{0};
+        uint32_t fileVersion{0};
+        uint32_t count{0};
+        if (buffer.size() < 16 || memcmp(buffer.data(), "KTUNECH1", 8) != 0) {
+            return 0;
+        }
+        memcpy(&fileVersion, buffer.data() + 8, sizeof(fileVersion));
+        memcpy(&count, buffer.data() + 12, sizeof(count));
+        if (fileVersion != version && fileVersion != 1) { return 0; }
+        offset = 16;
+        for (uint32_t i = 0 ; i < count ; i++) {
+            Record record;
+            if (offset + sizeof(Header) > buffer.size()) { break; }
+            memcpy(&record.header, buffer.data() + offset, sizeof(Header));
+            if (fileVersion == 1) {
+                uint64_t time;
+                memcpy(&time, &record.header.bestCost, sizeof(time));
+                record.header.bestCost = time == UINT64_MAX ? HUGE_VAL : (double)time;
+            }
+            offset += sizeof(Header);
+            size_t bytes = sizeof(Output) * record.header.numOutputs;
+            if (offset + bytes > buffer.size()) { break; }
+            record.outputs.resize(record.header.numOutputs);
+            memcpy(record.outputs.data(), buffer.data() + offset, bytes);
+            offset += bytes;
+            store(record);
+        }
+        return records_.size();
+    }
+    const Record* find(uint64_t signature) const {
+        auto iter = index_.find(signature);
+        if (iter == index_.end()) { return nullptr; }
+        return &(records_[iter->second]);
+    }
+    /* add a record, or replace the one with the same signature */
+    void store(const Record& record) {
+        auto iter = index_.find(record.header.signature);
+        if (iter != index_.end()) {
+            records_[iter->second] = record;
+            return;
+        }
+        index_[record.header.signature] = records_.size();
+        records_.push_back(record);
+    }
+    /* write to a temporary file and rename it, so that readers never see
+     * a partial file */
+    bool save(const std::string& path) const {
+        std::string tmp{path + ".tmp"};
+        FILE* fp = fopen(tmp.c_str(), "wb");
+        if (fp == nullptr) { return false; }
+        uint32_t count = (uint32_t)records_.size();
+        bool ok = fwrite("KTUNECH1", 8, 1, fp) == 1 &&
+                  fwrite(&version, sizeof(version), 1, fp) == 1 &&
+                  fwrite(&count, sizeof(count), 1, fp) == 1;
+        for (size_t i = 0 ; ok && i < records_.size() ; i++) {
+            const Record& r = records_[i];
+            ok = fwrite(&r.header, sizeof(Header), 1, fp) == 1 &&
+                 fwrite(r.outputs.data(), sizeof(Output), r.outputs.size(), fp) == r.outputs.size();
+        }
+        ok = (fclose(fp) == 0) && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+            remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+    size_t size(void) const { return records_.size(); }
+private:
+    std::vector<Record> records_;
+    std::unordered_map<uint64_t,size_t> index_;
+};
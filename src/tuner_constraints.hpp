@@ -0,0 +1,255 @@
+#pragma once
+
+/* Joint constraints between the output variables of a search. Include this
+ * after tuner_space.hpp.
+ *
+ * The application declares them with simple_tuner_constrain_product (the
+ * product of some outputs is at most a bound: the tile sizes of an MDRange
+ * against the threads a block can have, a thread count against the cores)
+ * and simple_tuner_constrain (a predicate of its own over some outputs), see
+ * tuning_playground.hpp. A search applies every constraint whose variables
+ * are all among its outputs, and only hands out configurations that satisfy
+ * them.
+ *
+ * Configurations are checked as candidate indices. When one isn't feasible,
+ * repair() walks the constrained outputs depth first, trying the candidates
+ * nearest to the proposal first and cutting off partial configurations that
+ * are already over a product bound, so the joint space is never enumerated
+ * up front. Repairs are remembered, so a proposal that keeps coming back
+ * (a bandit that settled on an arm, say) is only walked once.
+ *
+ * None of this is thread safe: a FeasibleSpace belongs to one search, and is
+ * only used under its lock.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+/* is this combination of values (in the order they were constrained) valid? */
+typedef int (*simple_tuner_valid_fn)(size_t count, const Kokkos_Tools_VariableValue* values,
+    void* data);
+}
+
+struct Constraint {
+    /* the variable ids it is over */
+    std::vector<size_t> ids;
+    /* the product of the values is at most this, unless there's a predicate */
+    double bound;
+    simple_tuner_valid_fn valid;
+    void* data;
+};
+
+/* Every constraint declared so far. They are only read when a search is
+ * created, so declare them before the first context that uses them. */
+class ConstraintTable {
+public:
+    void add(Constraint constraint) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        all_.push_back(std::move(constraint));
+    }
+    std::vector<Constraint> all(void) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return all_;
+    }
+private:
+    std::mutex mutex_;
+    std::vector<Constraint> all_;
+};
+
+/* The constraints of one search, on positions in its outputs */
+class FeasibleSpace {
+public:
+    /* the constraints that only involve these outputs, which have these
+     * candidate spaces (nullptr for ones the tuner doesn't know) */
+    void build(const std::vector<Constraint>& constraints, const std::vector<size_t>& ids,
+        const std::vector<const CandidateSpace*>& spaces) {
+        spaces_ = spaces;
+        minimum_.assign(spaces.size(), 0.0);
+        constrained_.assign(spaces.size(), false);
+        for (const auto& constraint : constraints) {
+            Entry entry{constraint, {}, true, {}};
+            for (auto id : constraint.ids) {
+                size_t position{SIZE_MAX};
+                for (size_t i = 0 ; i < ids.size() ; i++) {
+                    if (ids[i] == id && spaces[i] != nullptr && spaces[i]->size() > 0) { position = i; }
+                }
+                if (position == SIZE_MAX) { break; }
+                entry.positions.push_back(position);
+            }
+            if (entry.positions.size() != constraint.ids.size() || entry.positions.empty()) {
+                continue;
+            }
+            for (auto p : entry.positions) {
+                constrained_[p] = true;
+                minimum_[p] = lowest(*spaces[p]);
+                // a negative factor breaks the bound on partial products
+                if (minimum_[p] < 0.0) { entry.prunable = false; }
+            }
+            if (constraint.valid != nullptr) {
+                entry.values.resize(entry.positions.size());
+                for (size_t v = 0 ; v < entry.values.size() ; v++) {
+                    entry.values[v].type_id = ids[entry.positions[v]];
+                    entry.values[v].metadata = nullptr;
+                }
+            }
+            entries_.push_back(std::move(entry));
+        }
+    }
+    bool empty(void) const { return entries_.empty(); }
+    /* does this output appear in any constraint? */
+    bool constrained(size_t position) const {
+        return !entries_.empty() && constrained_[position];
+    }
+    bool feasible(const size_t* indices) const {
+        for (const auto& entry : entries_) {
+            if (!satisfied(entry, indices)) { return false; }
+        }
+        return true;
+    }
+    /* How far outside the constraints a configuration is: the log of how
+     * far each product is over its bound, plus one for every predicate that
+     * says no. 0 for feasible configurations. */
+    double violation(const size_t* indices) const {
+        double total{0.0};
+        for (const auto& entry : entries_) {
+            if (satisfied(entry, indices)) { continue; }
+            if (entry.constraint.valid != nullptr || entry.constraint.bound <= 0.0) {
+                total += 1.0;
+                continue;
+            }
+            double product{1.0};
+            for (auto p : entry.positions) { product *= spaces_[p]->numericAt(indices[p]); }
+            total += std::log(product / entry.constraint.bound);
+        }
+        return total;
+    }
+    /* Move the configuration to a feasible one nearby, changing only the
+     * outputs marked movable. Returns false (and leaves indices alone) if
+     * there isn't one within the budget. */
+    bool repair(size_t* indices, const std::vector<bool>& movable) const {
+        if (feasible(indices)) { return true; }
+        std::vector<size_t> key(indices, indices + spaces_.size());
+        for (size_t p = 0 ; p < spaces_.size() ; p++) { key.push_back(movable[p] ? 1 : 0); }
+        auto known = repairs_.find(key);
+        if (known != repairs_.end()) {
+            if (known->second.empty()) { return false; }
+            std::copy(known->second.begin(), known->second.end(), indices);
+            return true;
+        }
+        if (repairs_.size() >= maxRepairs) { repairs_.clear(); }
+        Walk walk;
+        walk.original.assign(indices, indices + spaces_.size());
+        walk.depth.assign(spaces_.size(), SIZE_MAX);
+        for (size_t p = 0 ; p < spaces_.size() ; p++) {
+            if (movable[p] && constrained_[p]) {
+                walk.depth[p] = walk.dims.size();
+                walk.dims.push_back(p);
+            }
+        }
+        walk.budget = maxVisits;
+        if (descend(walk, 0, indices)) {
+            repairs_[key].assign(indices, indices + spaces_.size());
+            return true;
+        }
+        std::copy(walk.original.begin(), walk.original.end(), indices);
+        repairs_[key].clear();
+        return false;
+    }
+private:
+    /* how many partial configurations repair() may look at: it runs while
+     * a context waits for its values, so give up early rather than stall */
+    static constexpr size_t maxVisits{2000};
+    /* how many repairs are remembered before starting over */
+    static constexpr size_t maxRepairs{4096};
+    struct Entry {
+        Constraint constraint;
+        std::vector<size_t> positions;
+        bool prunable;
+        /* the values handed to the predicate, so checking doesn't allocate */
+        mutable std::vector<Kokkos_Tools_VariableValue> values;
+    };
+    struct Walk {
+        std::vector<size_t> original;
+        std::vector<size_t> dims;
+        /* where each output is in dims, SIZE_MAX if it is fixed */
+        std::vector<size_t> depth;
+        size_t budget;
+    };
+    std::vector<Entry> entries_;
+    std::vector<const CandidateSpace*> spaces_;
+    std::vector<double> minimum_;
+    std::vector<bool> constrained_;
+    /* proposal and movable outputs -> the repaired configuration, empty
+     * if there wasn't one */
+    mutable std::map<std::vector<size_t>,std::vector<size_t>> repairs_;
+    static double lowest(const CandidateSpace& space) {
+        if (space.kind() == CandidateSpace::Kind::Range) {
+            return std::min(space.numericAt(0), space.numericAt(space.size() - 1));
+        }
+        double least{space.numericAt(0)};
+        for (size_t i = 1 ; i < space.size() ; i++) {
+            least = std::min(least, space.numericAt(i));
+        }
+        return least;
+    }
+    bool satisfied(const Entry& entry, const size_t* indices) const {
+        if (entry.constraint.valid == nullptr) {
+            double product{1.0};
+            for (auto p : entry.positions) { product *= spaces_[p]->numericAt(indices[p]); }
+            return product <= entry.constraint.bound;
+        }
+        auto& values = entry.values;
+        for (size_t v = 0 ; v < values.size() ; v++) {
+            size_t p = entry.positions[v];
+            spaces_[p]->assign(values[v].value, indices[p]);
+        }
+        return entry.constraint.valid(values.size(), values.data(),
+            entry.constraint.data) != 0;
+    }
+    /* can the outputs assigned so far (dims up to 'level') still work out? */
+    bool promising(const Walk& walk, size_t level, const size_t* indices) const {
+        for (const auto& entry : entries_) {
+            bool complete{true};
+            double product{1.0};
+            for (auto p : entry.positions) {
+                bool assigned = walk.depth[p] == SIZE_MAX || walk.depth[p] <= level;
+                complete = complete && assigned;
+                product *= assigned ? spaces_[p]->numericAt(indices[p]) : minimum_[p];
+            }
+            if (complete) {
+                if (!satisfied(entry, indices)) { return false; }
+            } else if (entry.constraint.valid == nullptr && entry.prunable &&
+                       product > entry.constraint.bound) {
+                return false;
+            }
+        }
+        return true;
+    }
+    bool descend(Walk& walk, size_t level, size_t* indices) const {
+        if (level == walk.dims.size()) { return feasible(indices); }
+        size_t p = walk.dims[level];
+        size_t count = spaces_[p]->size();
+        size_t from = walk.original[p];
+        if (from >= count) { from = count / 2; }
+        // from, from - 1, from + 1, from - 2, ...
+        for (size_t offset = 0 ; offset < count ; offset++) {
+            for (int side = 0 ; side < (offset == 0 ? 1 : 2) ; side++) {
+                if (side == 0 ? from < offset : from + offset >= count) { continue; }
+                if (walk.budget == 0) { return false; }
+                walk.budget--;
+                indices[p] = side == 0 ? from - offset : from + offset;
+                if (promising(walk, level, indices) && descend(walk, level + 1, indices)) {
+                    return true;
+                }
+            }
+        }
+        indices[p] = walk.original[p];
+        return false;
+    }
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+/* Change detection for converged searches. Once a search has stopped, the
+ * occasional measurements of its best configuration go through a one sided
+ * CUSUM test against what the search measured for it: every sample adds
+ * how many standard deviations it is slower than the reference (plus the
+ * tolerance), clipped so that a few outliers can't raise the alarm, and the
+ * sum never goes below zero. When it passes the threshold the
+ * configuration has got slower for good, and the search is reopened, see
+ * Search::retune().
+ *
+ * Searches that came from the cache have no measurements to compare with,
+ * so they use their first few samples as the reference.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+class DriftDetector {
+public:
+    /* threshold in standard deviations (0 never raises the alarm), and the
+     * slowdown (as a fraction of the reference) that is not a change */
+    DriftDetector(double threshold = 0.0, double tolerance = 0.1) :
+        threshold_(threshold), tolerance_(tolerance) { reset(); }
+    /* learn the reference from the next samples */
+    void reset(void) {
+        mean_ = 0.0;
+        sd_ = 0.0;
+        learned_ = 0;
+        sum_ = 0.0;
+        sumsq_ = 0.0;
+        cusum_ = 0.0;
+    }
+    /* compare against this reference */
+    void reset(double mean, double sd) {
+        reset();
+        mean_ = mean;
+        sd_ = sd;
+        learned_ = warmup;
+    }
+    /* Add a sample. Returns true when the samples have drifted above the
+     * reference; the detector then starts over. */
+    bool add(double sample) {
+        if (threshold_ <= 0.0) { return false; }
+        if (learned_ < warmup) {
+            learned_++;
+            sum_ += sample;
+            sumsq_ += sample * sample;
+            if (learned_ == warmup) {
+                mean_ = sum_ / (double)warmup;
+                sd_ = std::sqrt(std::max(0.0, sumsq_ / (double)warmup - mean_ * mean_));
+            }
+            return false;
+        }
+        // timings are never better than a few percent apart
+        double sigma = std::max(sd_, minimumSpread * mean_);
+        if (sigma <= 0.0) { return false; }
+        double z = (sample - mean_ * (1.0 + tolerance_)) / sigma;
+        cusum_ = std::max(0.0, cusum_ + std::min(z, maximumStep));
+        if (cusum_ <= threshold_) { return false; }
+        reset();
+        return true;
+    }
+    double cusum(void) const { return cusum_; }
+private:
+    /* how many samples the reference is learned from */
+    static constexpr size_t warmup{5};
+    /* the most one sample can add, so that it takes a run of slow samples
+     * (and not a few outliers) to raise the alarm */
+    static constexpr double maximumStep{2.0};
+    /* the smallest standard deviation assumed, as a fraction of the mean */
+    static constexpr double minimumSpread{0.05};
+    double threshold_;
+    double tolerance_;
+    double mean_;
+    double sd_;
+    size_t learned_;
+    double sum_;
+    double sumsq_;
+    double cusum_;
+};
@@ -0,0 +1,318 @@
+#pragma once
+
+/* Derivative-free local searches used by the simple tuner for range and
+ * ordinal variables. A search works on a box of 'levels': dimension d takes
+ * values from 0 to levels[d]-1, where level i is the i-th valid value of
+ * the variable (lower bound plus i steps, or the i-th candidate of an
+ * ordinal set). Points are real valued inside the search and rounded to the
+ * nearest level when they are handed out.
+ *
+ * The interface is ask/tell: ask() returns the next point to measure, and
+ * tell() gives back the cost (lower is better) of the last point asked for.
+ */
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <numeric>
+
+class LocalSearch {
+public:
+    LocalSearch(const std::vector<size_t>& levels,
+        const std::vector<double>& start) :
+        levels_(levels), best_(start), bestCost_(HUGE_VAL), evaluations_(0) { }
+    virtual ~LocalSearch() { }
+    virtual const std::vector<double>& ask(void) = 0;
+    virtual void tell(double cost) = 0;
+    virtual bool converged(void) const = 0;
+    virtual const char* name(void) const = 0;
+    const std::vector<double>& best(void) const { return best_; }
+    double bestCost(void) const { return bestCost_; }
+    size_t evaluations(void) const { return evaluations_; }
+    size_t dimensions(void) const { return levels_.size(); }
+    /* the level a point coordinate hands out */
+    size_t level(const std::vector<double>& point, size_t d) const {
+        double x = std::round(clamp(point[d], d));
+        return (size_t)x;
+    }
+protected:
+    std::vector<size_t> levels_;
+    std::vector<double> best_;
+    double bestCost_;
+    size_t evaluations_;
+    double upper(size_t d) const { return (double)(levels_[d] - 1); }
+    double clamp(double x, size_t d) const {
+        return std::min(std::max(x, 0.0), upper(d));
+    }
+    void clamp(std::vector<double>& point) const {
+        for (size_t d = 0 ; d < point.size() ; d++) {
+            point[d] = clamp(point[d], d);
+        }
+    }
+    void record(const std::vector<double>& point, double cost) {
+        evaluations_++;
+        if (cost < bestCost_) {
+            bestCost_ = cost;
+            best_ = point;
+        }
+    }
+    /* do two points hand out the same configuration? */
+    bool sameLevels(const std::vector<double>& a, const std::vector<double>& b) const {
+        for (size_t d = 0 ; d < a.size() ; d++) {
+            if (level(a, d) != level(b, d)) { return false; }
+        }
+        return true;
+    }
+};
+
+/* Nelder-Mead simplex search, written as a state machine so that it can be
+ * driven one measurement at a time. The initial simplex is the starting
+ * point plus one vertex 'spread' of the way (a quarter, unless the start is
+ * already known to be good) across each dimension. It has converged when
+ * every vertex rounds to the same configuration. */
+class NelderMead : public LocalSearch {
+public:
+    NelderMead(const std::vector<size_t>& levels,
+        const std::vector<double>& start, double spread = 0.25) :
+        LocalSearch(levels, start), state_(State::Init), initIndex_(0) {
+        size_t n = levels.size();
+        simplex_.push_back(start);
+        for (size_t d = 0 ; d < n ; d++) {
+            std::vector<double> vertex(start);
+            double offset = std::max(1.0, spread * upper(d));
+            // go the other way if we would fall off the end
+            vertex[d] = (vertex[d] + offset <= upper(d)) ?
+                vertex[d] + offset : vertex[d] - offset;
+            clamp(vertex);
+            simplex_.push_back(vertex);
+        }
+        costs_.resize(simplex_.size(), HUGE_VAL);
+    }
+    const char* name(void) const { return "nelder-mead"; }
+    bool converged(void) const {
+        if (state_ == State::Init) { return false; }
+        for (size_t i = 1 ; i < simplex_.size() ; i++) {
+            if (!sameLevels(simplex_[0], simplex_[i])) { return false; }
+        }
+        return true;
+    }
+    const std::vector<double>& ask(void) {
+        if (converged()) {
+            trial_ = best_;
+        } else if (state_ == State::Init || state_ == State::Shrink) {
+            trial_ = simplex_[initIndex_];
+        }
+        // the other states set up trial_ when they are entered
+        return trial_;
+    }
+    void tell(double cost) {
+        record(trial_, cost);
+        if (converged()) { return; }
+        size_t n = simplex_.size() - 1;
+        switch (state_) {
+            case State::Init:
+            case State::Shrink:
+            {
+                costs_[initIndex_] = cost;
+                // after a shrink, the best vertex doesn't need measuring again
+                initIndex_++;
+                if (initIndex_ > n) {
+                    startIteration();
+                }
+                break;
+            }
+            case State::Reflect:
+            {
+                reflectCost_ = cost;
+                if (cost < costs_[0]) {
+                    // try going further the same way
+                    reflected_ = trial_;
+                    trial_ = along(2.0);
+                    state_ = State::Expand;
+                } else if (cost < costs_[n - 1]) {
+                    replaceWorst(trial_, cost);
+                } else if (cost < costs_[n]) {
+                    reflected_ = trial_;
+                    trial_ = along(0.5);
+                    state_ = State::ContractOutside;
+                } else {
+                    trial_ = along(-0.5);
+                    state_ = State::ContractInside;
+                }
+                break;
+            }
+            case State::Expand:
+            {
+                if (cost < reflectCost_) {
+                    replaceWorst(trial_, cost);
+                } else {
+                    replaceWorst(reflected_, reflectCost_);
+                }
+                break;
+            }
+            case State::ContractOutside:
+            {
+                if (cost <= reflectCost_) {
+                    replaceWorst(trial_, cost);
+                } else {
+                    shrink();
+                }
+                break;
+            }
+            case State::ContractInside:
+            {
+                if (cost < costs_[n]) {
+                    replaceWorst(trial_, cost);
+                } else {
+                    shrink();
+                }
+                break;
+            }
+        }
+    }
+private:
+    enum class State { Init, Reflect, Expand, ContractOutside, ContractInside, Shrink };
+    State state_;
+    size_t initIndex_;
+    std::vector<std::vector<double>> simplex_;
+    std::vector<double> costs_;
+    std::vector<double> centroid_;
+    std::vector<double> trial_;
+    std::vector<double> reflected_;
+    double reflectCost_;
+    /* sort the simplex, and start a new iteration with a reflection */
+    void startIteration(void) {
+        std::vector<size_t> order(simplex_.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return costs_[a] < costs_[b]; });
+        std::vector<std::vector<double>> simplex;
+        std::vector<double> costs;
+        for (auto i : order) {
+            simplex.push_back(simplex_[i]);
+            costs.push_back(costs_[i]);
+        }
+        simplex_.swap(simplex);
+        costs_.swap(costs);
+        if (converged()) { return; }
+        // centroid of everything but the worst vertex
+        size_t n = simplex_.size() - 1;
+        centroid_.assign(dimensions(), 0.0);
+        for (size_t i = 0 ; i < n ; i++) {
+            for (size_t d = 0 ; d < dimensions() ; d++) {
+                centroid_[d] += simplex_[i][d] / (double)n;
+            }
+        }
+        trial_ = along(1.0);
+        state_ = State::Reflect;
+    }
+    /* the point centroid + coefficient * (centroid - worst) */
+    std::vector<double> along(double coefficient) {
+        std::vector<double> point(dimensions());
+        const std::vector<double>& worst = simplex_.back();
+        for (size_t d = 0 ; d < dimensions() ; d++) {
+            point[d] = centroid_[d] + coefficient * (centroid_[d] - worst[d]);
+        }
+        clamp(point);
+        return point;
+    }
+    void replaceWorst(const std::vector<double>& point, double cost) {
+        simplex_.back() = point;
+        costs_.back() = cost;
+        startIteration();
+    }
+    /* pull everything halfway toward the best vertex, then measure the
+     * new vertices */
+    void shrink(void) {
+        for (size_t i = 1 ; i < simplex_.size() ; i++) {
+            for (size_t d = 0 ; d < dimensions() ; d++) {
+                simplex_[i][d] = simplex_[0][d] + 0.5 * (simplex_[i][d] - simplex_[0][d]);
+            }
+        }
+        initIndex_ = 1;
+        state_ = State::Shrink;
+        if (converged()) {
+            startIteration();
+        }
+    }
+};
+
+/* Coordinate descent: move along one dimension at a time, trying a step up
+ * and a step down. A move that improves is kept (and tried again), and when
+ * neither direction helps the step for that dimension is halved. It has
+ * converged when every dimension is down to less than one level. */
+class CoordinateDescent : public LocalSearch {
+public:
+    CoordinateDescent(const std::vector<size_t>& levels,
+        const std::vector<double>& start, double spread = 0.25) :
+        LocalSearch(levels, start), current_(start), currentCost_(HUGE_VAL),
+        dimension_(0), direction_(1.0), started_(false) {
+        for (size_t d = 0 ; d < levels.size() ; d++) {
+            steps_.push_back(std::max(1.0, std::floor(spread * upper(d))));
+        }
+        for (size_t d = 0 ; d < levels.size() ; d++) {
+            current_[d] = std::round(clamp(current_[d], d));
+        }
+    }
+    const char* name(void) const { return "coordinate"; }
+    bool converged(void) const {
+        if (!started_) { return false; }
+        for (auto s : steps_) {
+            if (s >= 1.0) { return false; }
+        }
+        return true;
+    }
+    const std::vector<double>& ask(void) {
+        if (!started_ || converged()) {
+            trial_ = started_ ? best_ : current_;
+            return trial_;
+        }
+        // skip moves that would fall off the end of a dimension
+        while (!converged()) {
+            trial_ = current_;
+            trial_[dimension_] = clamp(current_[dimension_] +
+                direction_ * steps_[dimension_], dimension_);
+            if (trial_[dimension_] != current_[dimension_]) { break; }
+            nextMove();
+        }
+        return trial_;
+    }
+    void tell(double cost) {
+        record(trial_, cost);
+        if (!started_) {
+            started_ = true;
+            currentCost_ = cost;
+            return;
+        }
+        if (converged()) { return; }
+        if (cost < currentCost_) {
+            // keep going the same way
+            current_ = trial_;
+            currentCost_ = cost;
+        } else {
+            nextMove();
+        }
+    }
+private:
+    std::vector<double> current_;
+    double currentCost_;
+    std::vector<double> steps_;
+    std::vector<double> trial_;
+    size_t dimension_;
+    double direction_;
+    bool started_;
+    void nextMove(void) {
+        if (direction_ > 0.0) {
+            direction_ = -1.0;
+            return;
+        }
+        direction_ = 1.0;
+        steps_[dimension_] = std::floor(steps_[dimension_] / 2.0);
+        // find the next dimension that still has somewhere to go
+        for (size_t i = 0 ; i < steps_.size() ; i++) {
+            dimension_ = (dimension_ + 1) % steps_.size();
+            if (steps_[dimension_] >= 1.0) { break; }
+        }
+    }
+};
@@ -0,0 +1,313 @@
+#pragma once
+
+/* What a context measures, chosen with KOKKOS_TUNING_OBJECTIVE. Everything
+ * downstream (statistics, strategies, the report, the cache) works on the
+ * difference between a reading at request_values and one at end_context,
+ * whatever the units are.
+ *
+ *   time          wall clock, ns (the default)
+ *   cycles        CPU cycles of the calling thread (perf_event)
+ *   instructions  instructions retired by the calling thread (perf_event)
+ *   cache-misses  last level cache misses of the calling thread (perf_event)
+ *   energy        package energy, uJ (RAPL through powercap)
+ *
+ * The hardware counters only count the thread that opened the context, so
+ * they suit serial kernels and host-side work. Package energy covers the
+ * whole socket, so contexts that overlap in time share it. If a counter
+ * can't be opened (no Linux, no permission, no RAPL), the tuner reports it
+ * and goes back to wall clock time.
+ *
+ * Time is read from CLOCK_MONOTONIC_RAW, which never jumps and isn't
+ * slewed by NTP. Kernels on GPU backends may still be running when the
+ * application ends a context, so if Kokkos gives the tool its fence (see
+ * kokkosp_provide_tool_programming_interface) a measurement starts and
+ * stops with one, and it times the kernels instead of their launches.
+ * What it costs to take a measurement of nothing at all (the readings and
+ * the fence on an idle device) is calibrated the first time, in the units
+ * of the objective, and subtracted from every measurement.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+enum class Objective { Time, Cycles, Instructions, CacheMisses, Energy };
+
+inline Objective parseObjective(const std::string& name) {
+    if (name == "cycles") { return Objective::Cycles; }
+    if (name == "instructions") { return Objective::Instructions; }
+    if (name == "cache-misses") { return Objective::CacheMisses; }
+    if (name == "energy") { return Objective::Energy; }
+    return Objective::Time;
+}
+
+inline const char* pObjective(Objective o) {
+    if (o == Objective::Cycles) { return "cycles"; }
+    if (o == Objective::Instructions) { return "instructions"; }
+    if (o == Objective::CacheMisses) { return "cache-misses"; }
+    if (o == Objective::Energy) { return "energy"; }
+    return "time";
+}
+
+/* the short name of the units, for the report */
+inline const char* objectiveUnits(Objective o) {
+    if (o == Objective::Cycles) { return "cycles"; }
+    if (o == Objective::Instructions) { return "instructions"; }
+    if (o == Objective::CacheMisses) { return "misses"; }
+    if (o == Objective::Energy) { return "uJ"; }
+    return "ns";
+}
+
+/* One perf_event counter for the calling thread. */
+class PerfCounter {
+public:
+    /* what read() returns when there is no count */
+    static constexpr uint64_t unreadable{UINT64_MAX};
+    PerfCounter() : fd_(-1), tried_(false) { }
+    ~PerfCounter() {
+#ifdef __linux__
+        if (fd_ >= 0) { close(fd_); }
+#endif
+    }
+    bool isOpen(void) const { return fd_ >= 0; }
+    /* has open() been called (whether or not it worked)? */
+    bool tried(void) const { return tried_; }
+    bool open(Objective objective) {
+        tried_ = true;
+#ifdef __linux__
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        if (objective == Objective::Cycles) {
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        } else if (objective == Objective::Instructions) {
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        } else {
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        }
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        return fd_ >= 0;
+    }
+    uint64_t read(void) const {
+        uint64_t value{unreadable};
+#ifdef __linux__
+        if (fd_ < 0 || ::read(fd_, &value, sizeof(value)) != sizeof(value)) { return unreadable; }
+#endif
+        return value;
+    }
+private:
+    int fd_;
+    bool tried_;
+};
+
+/* Package energy from the powercap interface. The counter wraps around at
+ * max_energy_range_uj, so differences are taken modulo that. */
+class RaplCounter {
+public:
+    RaplCounter() : fd_(-1), range_(0) { }
+    ~RaplCounter() {
+#ifdef __linux__
+        if (fd_ >= 0) { close(fd_); }
+#endif
+    }
+    bool open(void) {
+#ifdef __linux__
+        const char* base = "/sys/class/powercap/intel-rapl:0/";
+        std::string range = readFile(base, "max_energy_range_uj");
+        if (range.empty()) { return false; }
+        range_ = strtoull(range.c_str(), nullptr, 10);
+        fd_ = ::open((std::string(base) + "energy_uj").c_str(), O_RDONLY);
+#endif
+        return fd_ >= 0;
+    }
+    uint64_t read(void) const {
+        char buffer[32] = {0};
+#ifdef __linux__
+        if (fd_ < 0 || pread(fd_, buffer, sizeof(buffer) - 1, 0) <= 0) { return 0; }
+#endif
+        return strtoull(buffer, nullptr, 10);
+    }
+    uint64_t difference(uint64_t start, uint64_t end) const {
+        if (end >= start || range_ == 0) { return end - start; }
+        return end + (range_ - start);
+    }
+private:
+    int fd_;
+    uint64_t range_;
+    static std::string readFile(const char* base, const char* name) {
+        std::string path = std::string(base) + name;
+        FILE* fp = fopen(path.c_str(), "r");
+        if (fp == nullptr) { return ""; }
+        char buffer[32] = {0};
+        size_t got = fread(buffer, 1, sizeof(buffer) - 1, fp);
+        fclose(fp);
+        return std::string(buffer, got);
+    }
+};
+
+/* Readings of the selected objective. configure() is called once at init;
+ * hardware counters are opened on each thread the first time it reads. A
+ * measurement is start() and stop(), and elapsed() the difference between
+ * them without the overhead. */
+class Meter {
+public:
+    typedef void (*FenceFunction)(uint32_t);
+    /* one measurement of nothing, taken the way the hooks take theirs */
+    typedef uint64_t (*SampleFunction)(void);
+    /* fence before every start() and stop(), with the fence Kokkos gave us */
+    static void setFence(FenceFunction fence, bool use) {
+        fence_().store(use ? fence : nullptr, std::memory_order_release);
+    }
+    static bool fenced(void) { return fence_().load(std::memory_order_acquire) != nullptr; }
+    /* The fence is for the whole device, so it would make trials on other
+     * instances of it wait for each other. While any caller has it held
+     * off, measurements aren't fenced (the trials fence their own
+     * instances instead). */
+    static void holdFence(bool hold) {
+        held_().fetch_add(hold ? 1 : -1, std::memory_order_acq_rel);
+    }
+    /* the overhead to subtract: fixed (in the units of the objective), or
+     * the median of sample() the first time calibrate() is called, if
+     * there is a sample function */
+    static void setOverhead(SampleFunction sample, uint64_t overhead) {
+        sample_() = sample;
+        overhead_().store(overhead, std::memory_order_relaxed);
+    }
+    static uint64_t overhead(void) { return overhead_().load(std::memory_order_relaxed); }
+    static void calibrate(void) {
+        if (sample_() != nullptr) { std::call_once(calibrated_(), measureOverhead); }
+    }
+    static uint64_t start(void) {
+        fence();
+        return read();
+    }
+    static uint64_t stop(void) {
+        fence();
+        return read();
+    }
+    /* Did both readings work? A thread that can't open its hardware counter
+     * (the init thread could, so the objective stuck) has no readings, and
+     * its contexts aren't measured rather than costing nothing. */
+    static bool valid(uint64_t start, uint64_t end) {
+        return start != PerfCounter::unreadable && end != PerfCounter::unreadable;
+    }
+    static uint64_t elapsed(uint64_t start, uint64_t end) {
+        uint64_t measured = difference(start, end);
+        uint64_t overhead = overhead_().load(std::memory_order_relaxed);
+        return measured > overhead ? measured - overhead : 0;
+    }
+    /* returns the objective that will actually be used */
+    static Objective configure(Objective wanted) {
+        objective_() = wanted;
+        if (wanted == Objective::Energy) {
+            if (!rapl().open()) { objective_() = Objective::Time; }
+        } else if (wanted != Objective::Time) {
+            if (!thread().open(wanted)) { objective_() = Objective::Time; }
+        }
+        return objective_();
+    }
+    static Objective objective(void) { return objective_(); }
+    static uint64_t read(void) {
+        switch (objective_()) {
+            case Objective::Time:
+                return nanoseconds();
+            case Objective::Energy:
+                return rapl().read();
+            default:
+                return counter().read();
+        }
+    }
+    static uint64_t difference(uint64_t start, uint64_t end) {
+        if (objective_() == Objective::Energy) { return rapl().difference(start, end); }
+        return end > start ? end - start : 0;
+    }
+    /* high_resolution_clock can be the system clock, which can jump */
+    static uint64_t nanoseconds(void) {
+#ifdef __linux__
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+private:
+    /* empty measurements the overhead is the median of */
+    static constexpr size_t calibrationSamples{201};
+    static Objective& objective_(void) {
+        static Objective objective{Objective::Time};
+        return objective;
+    }
+    static std::atomic<FenceFunction>& fence_(void) {
+        static std::atomic<FenceFunction> fence{nullptr};
+        return fence;
+    }
+    static std::atomic<int>& held_(void) {
+        static std::atomic<int> held{0};
+        return held;
+    }
+    static void fence(void) {
+        FenceFunction fence = fence_().load(std::memory_order_acquire);
+        if (fence != nullptr && held_().load(std::memory_order_acquire) == 0) { fence(0); }
+    }
+    static SampleFunction& sample_(void) {
+        static SampleFunction sample{nullptr};
+        return sample;
+    }
+    static std::once_flag& calibrated_(void) {
+        static std::once_flag flag;
+        return flag;
+    }
+    static std::atomic<uint64_t>& overhead_(void) {
+        static std::atomic<uint64_t> overhead{0};
+        return overhead;
+    }
+    /* The package energy counter moves in steps far bigger than this, so it
+     * isn't calibrated. */
+    static void measureOverhead(void) {
+        if (objective_() == Objective::Energy) { return; }
+        std::vector<uint64_t> samples(calibrationSamples);
+        for (auto& sample : samples) {
+            sample = sample_()();
+        }
+        std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+        overhead_().store(samples[samples.size() / 2], std::memory_order_relaxed);
+    }
+    static RaplCounter& rapl(void) {
+        static RaplCounter counter;
+        return counter;
+    }
+    static PerfCounter& thread(void) {
+        static thread_local PerfCounter counter;
+        return counter;
+    }
+    /* the calling thread's counter, opened on first use */
+    static PerfCounter& counter(void) {
+        PerfCounter& c = thread();
+        if (!c.tried() && !c.open(objective_())) {
+            fprintf(stderr, "Unable to open the %s counter on a thread, its contexts won't be measured\n",
+                pObjective(objective_()));
+        }
+        return c;
+    }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+/* A nearest neighbour model from the inputs of a search to its best
+ * configuration, for KOKKOS_TUNING_MODEL. Include this after
+ * Kokkos_Core.hpp, it needs the tuning variable types.
+ *
+ * Searches are grouped into families: the same outputs, and the same
+ * values of every input except the numeric ones with an order to them (the
+ * sizes that declareInputViewSize gives us, say). Within a family a search
+ * is a point in the space of those numeric inputs, on a log2 scale since
+ * they are usually sizes, and every search publishes its best configuration
+ * so far. A new search starts from the configuration of the nearest search
+ * of its family that has one, so a new mesh size or refinement level starts
+ * next to the answer for the sizes around it instead of at the defaults.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ConfigModel {
+public:
+    typedef union Kokkos_Tools_VariableValue_ValueUnion Value;
+    /* a numeric input as a feature */
+    static double feature(double value) {
+        return value < 0.0 ? -std::log2(1.0 - value) : std::log2(1.0 + value);
+    }
+    /* the best configuration of a search (owner), replacing what it
+     * published before */
+    void publish(uint64_t family, const void* owner, const std::vector<double>& features,
+        const Value* values, size_t count, const std::string& description) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto& entries = families_[family];
+        for (auto& entry : entries) {
+            if (entry.owner == owner) {
+                entry.values.assign(values, values + count);
+                return;
+            }
+        }
+        entries.push_back(Entry{owner, features,
+            std::vector<Value>(values, values + count), description});
+    }
+    /* The configuration of the nearest search of the family, and its
+     * description. Returns false if no search of the family has one yet. */
+    bool predict(uint64_t family, const std::vector<double>& features,
+        std::vector<Value>& values, std::string& from) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto iter = families_.find(family);
+        if (iter == families_.end()) { return false; }
+        const Entry* nearest{nullptr};
+        double nearestDistance{HUGE_VAL};
+        for (const auto& entry : iter->second) {
+            if (entry.features.size() != features.size()) { continue; }
+            double distance{0.0};
+            for (size_t f = 0 ; f < features.size() ; f++) {
+                double d = entry.features[f] - features[f];
+                distance += d * d;
+            }
+            if (distance < nearestDistance) {
+                nearestDistance = distance;
+                nearest = &entry;
+            }
+        }
+        if (nearest == nullptr) { return false; }
+        values = nearest->values;
+        from = nearest->description;
+        return true;
+    }
+private:
+    struct Entry {
+        const void* owner;
+        std::vector<double> features;
+        std::vector<Value> values;
+        std::string description;
+    };
+    std::mutex mutex_;
+    std::unordered_map<uint64_t,std::vector<Entry>> families_;
+};
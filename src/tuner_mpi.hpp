@@ -0,0 +1,145 @@
+#pragma once
+
+/* Sharing results between MPI ranks (built with SIMPLE_TUNER_MPI). Every
+ * rank runs its own searches, and every so often the ranks swap the best
+ * configuration each of them has found, with a non-blocking allgather so the
+ * hooks never wait for the other ranks. Each rank gets the same records from
+ * an exchange, so picking the cheapest one is an agreement: all the ranks
+ * choose the same configuration, and switch to it in the same round.
+ *
+ * Exchanges are collectives, so every rank has to take part in the same
+ * number of them. Ranks start them at their own pace, and at finalize the
+ * ranks agree (on a second communicator) how many there were, and the ranks
+ * that are behind catch up.
+ *
+ * Only the thread that initialized the tuner calls MPI, so an application
+ * that initialized MPI with MPI_THREAD_FUNNELED is fine. Without MPI support
+ * (or without MPI_Init, or with one rank) nothing is ever exchanged.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#ifdef SIMPLE_TUNER_USE_MPI
+#include <mpi.h>
+#endif
+
+class MpiExchange {
+public:
+    /* searches with more outputs than this aren't shared */
+    static constexpr size_t maxOutputs{8};
+    /* how many searches a rank can share in one exchange */
+    static constexpr size_t maxRecords{32};
+    struct Record {
+        uint64_t signature;   // 0 for an unused record
+        double cost;          // of the best configuration
+        uint64_t trials;      // on the rank that sent it
+        uint32_t converged;   // the sender's search has nothing left to learn
+        uint32_t numOutputs;
+        uint32_t indices[maxOutputs];  // candidate indices, UINT32_MAX for none
+    };
+    static_assert(sizeof(Record) == 64, "exchange records should be one cache line");
+    MpiExchange() : enabled_(false), busy_(false), rank_(0), size_(1), rounds_(0) { }
+    /* at init: returns whether there are other ranks to talk to */
+    bool start(void) {
+#ifdef SIMPLE_TUNER_USE_MPI
+        int initialized{0};
+        MPI_Initialized(&initialized);
+        if (!initialized) { return false; }
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
+        MPI_Comm_size(MPI_COMM_WORLD, &size_);
+        if (size_ < 2) { return false; }
+        MPI_Comm_dup(MPI_COMM_WORLD, &data_);
+        MPI_Comm_dup(MPI_COMM_WORLD, &control_);
+        outgoing_.resize(maxRecords);
+        incoming_.resize(maxRecords * (size_t)size_);
+        owner_ = std::this_thread::get_id();
+        enabled_ = true;
+#endif
+        return enabled_;
+    }
+    bool enabled(void) const { return enabled_; }
+    int rank(void) const { return rank_; }
+    int size(void) const { return size_; }
+    /* only this thread may call post(), test(), wait() and finish() */
+    bool owner(void) const { return std::this_thread::get_id() == owner_; }
+    /* is an exchange in flight? */
+    bool busy(void) const { return busy_; }
+    /* the records to send next, fill these in before post() */
+    Record* outgoing(void) { return outgoing_.data(); }
+    /* start an exchange of the first count outgoing records */
+    void post(size_t count) {
+        if (!enabled_ || busy_) { return; }
+        for (size_t i = count ; i < maxRecords ; i++) { outgoing_[i].signature = 0; }
+#ifdef SIMPLE_TUNER_USE_MPI
+        MPI_Iallgather(outgoing_.data(), (int)(maxRecords * sizeof(Record)), MPI_BYTE,
+            incoming_.data(), (int)(maxRecords * sizeof(Record)), MPI_BYTE,
+            data_, &request_);
+#endif
+        busy_ = true;
+        rounds_++;
+    }
+    /* has the exchange in flight finished? then incoming() has its records */
+    bool test(void) {
+        if (!busy_) { return false; }
+#ifdef SIMPLE_TUNER_USE_MPI
+        int done{0};
+        MPI_Test(&request_, &done, MPI_STATUS_IGNORE);
+        if (!done) { return false; }
+#endif
+        busy_ = false;
+        return true;
+    }
+    void wait(void) {
+        if (!busy_) { return; }
+#ifdef SIMPLE_TUNER_USE_MPI
+        MPI_Wait(&request_, MPI_STATUS_IGNORE);
+#endif
+        busy_ = false;
+    }
+    /* every record of the last exchange, rank by rank */
+    const std::vector<Record>& incoming(void) const { return incoming_; }
+    /* At finalize: finish the exchange in flight, and join in the ones this
+     * rank is behind on, so every rank has done the same number. */
+    void align(void) {
+        if (!enabled_) { return; }
+#ifdef SIMPLE_TUNER_USE_MPI
+        // before waiting, the others may still have to start this one
+        uint64_t mine{rounds_}, most{0};
+        MPI_Allreduce(&mine, &most, 1, MPI_UINT64_T, MPI_MAX, control_);
+        wait();
+        while (rounds_ < most) {
+            post(0);
+            wait();
+        }
+#endif
+    }
+    /* after the last exchange */
+    void stop(void) {
+        if (!enabled_) { return; }
+#ifdef SIMPLE_TUNER_USE_MPI
+        int finalized{0};
+        MPI_Finalized(&finalized);
+        if (!finalized) {
+            MPI_Comm_free(&data_);
+            MPI_Comm_free(&control_);
+        }
+#endif
+        enabled_ = false;
+    }
+private:
+    bool enabled_;
+    bool busy_;
+    int rank_;
+    int size_;
+    uint64_t rounds_;
+    std::thread::id owner_;
+    std::vector<Record> outgoing_;
+    std::vector<Record> incoming_;
+#ifdef SIMPLE_TUNER_USE_MPI
+    MPI_Comm data_;
+    MPI_Comm control_;
+    MPI_Request request_;
+#endif
+};
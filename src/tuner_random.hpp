@@ -0,0 +1,112 @@
+#pragma once
+
+/* Random numbers for the simple tuner. rand() takes a lock in glibc, has
+ * poor low bits, and can't be seeded per run without affecting the
+ * application, so the tuner has its own generators: xoshiro256** (Blackman
+ * and Vigna), seeded through splitmix64.
+ *
+ * Every thread gets its own generator, and every one of those is a separate
+ * stream of the same seed (2^128 values apart), so the sequences can't
+ * overlap. Streams are numbered in the order that threads first ask for
+ * one, so a run is reproducible for a given KOKKOS_TUNING_SEED as long as
+ * the threads that draw numbers start in the same order.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+class Xoshiro256 {
+public:
+    /* what the tuner uses when KOKKOS_TUNING_SEED isn't set */
+    static constexpr uint64_t defaultSeed{0x5eed5eed5eed5eedULL};
+    explicit Xoshiro256(uint64_t seed = defaultSeed) {
+        for (auto& s : state_) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            s = z ^ (z >> 31);
+        }
+    }
+    uint64_t next(void) {
+        uint64_t result = rotl(state_[1] * 5, 7) * 9;
+        uint64_t t = state_[1] << 17;
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= t;
+        state_[3] = rotl(state_[3], 45);
+        return result;
+    }
+    /* uniform in [0, n), by multiply and shift instead of a modulo, so
+     * it uses the high bits and doesn't need a division */
+    size_t below(size_t n) {
+        return (size_t)(((unsigned __int128)next() * n) >> 64);
+    }
+    /* uniform in (0, 1), never exactly 0 so it is safe to take the log */
+    double uniform(void) {
+        return ((double)(next() >> 11) + 0.5) * 0x1.0p-53;
+    }
+    double standardNormal(void) {
+        // Box-Muller
+        double u1 = uniform();
+        double u2 = uniform();
+        return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+    }
+    /* advance by 2^128 values, the start of the next stream */
+    void jump(void) {
+        static const uint64_t jumps[] = { 0x180ec6d33cfd0abaULL,
+            0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+        uint64_t s[4] = {0, 0, 0, 0};
+        for (auto j : jumps) {
+            for (int b = 0 ; b < 64 ; b++) {
+                if (j & (uint64_t{1} << b)) {
+                    for (int i = 0 ; i < 4 ; i++) { s[i] ^= state_[i]; }
+                }
+                next();
+            }
+        }
+        for (int i = 0 ; i < 4 ; i++) { state_[i] = s[i]; }
+    }
+private:
+    uint64_t state_[4];
+    static uint64_t rotl(const uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+/* The per-thread generators. Call seed() before any thread draws a number
+ * (the tuner does it in kokkosp_init_library). */
+class TunerRandom {
+public:
+    static void seed(uint64_t value) {
+        Streams& streams = streams_();
+        std::lock_guard<std::mutex> guard(streams.mutex);
+        streams.next = Xoshiro256(value);
+    }
+    static Xoshiro256& get(void) {
+        static thread_local Xoshiro256 generator{stream()};
+        return generator;
+    }
+private:
+    /* the start of the stream the next thread gets, so a new thread only
+     * costs one jump however many came before it */
+    struct Streams {
+        std::mutex mutex;
+        Xoshiro256 next;
+    };
+    static Streams& streams_(void) {
+        static Streams streams;
+        return streams;
+    }
+    static Xoshiro256 stream(void) {
+        Streams& streams = streams_();
+        std::lock_guard<std::mutex> guard(streams.mutex);
+        Xoshiro256 generator = streams.next;
+        streams.next.jump();
+        return generator;
+    }
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+/* Typed candidate spaces for the simple tuner. Include this after
+ * Kokkos_Core.hpp, it needs the tuning variable types.
+ *
+ * Every output variable gets a CandidateSpace that numbers its valid values
+ * from 0 to size()-1, and the search strategies only ever deal in those
+ * indices:
+ *   - sets keep their candidates in a contiguous array of the declared type
+ *     (strings are interned, and stored as pointers into the pool),
+ *   - ranges are quantized to their step, so index i is lower + i * step,
+ *     with the open/closed bounds already applied.
+ * Turning an index back into a value is a load (or a multiply-add), so
+ * nothing on the request path has to parse or convert anything.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+/* One copy of every candidate string. Entries are never moved or freed, so
+ * the pointers can be used without holding the lock. */
+class StringPool {
+public:
+    static StringPool& get(void) {
+        static StringPool pool;
+        return pool;
+    }
+    const char* intern(const char* str) {
+        std::string key(str, strnlen(str, KOKKOS_TOOLS_TUNING_STRING_LENGTH));
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto iter = index_.find(key);
+        if (iter != index_.end()) { return iter->second; }
+        strings_.emplace_back();
+        char* entry = strings_.back().value;
+        memset(entry, 0, KOKKOS_TOOLS_TUNING_STRING_LENGTH);
+        memcpy(entry, key.data(), key.size());
+        index_[key] = entry;
+        return entry;
+    }
+private:
+    struct Entry { Kokkos_Tools_Tuning_String value; };
+    std::mutex mutex_;
+    std::deque<Entry> strings_;
+    std::unordered_map<std::string,const char*> index_;
+};
+
+class CandidateSpace {
+public:
+    enum class Kind { Empty, Set, Range };
+    CandidateSpace() : kind_(Kind::Empty), type_(kokkos_value_int64),
+        size_(0), dlower_(0.0), dupper_(0.0), dstep_(0.0),
+        llower_(0), lstep_(1) { }
+    /* ranges declared without a step get this many levels */
+    static constexpr size_t defaultLevels{1000};
+    void build(const Kokkos_Tools_VariableInfo& info) {
+        type_ = info.type;
+        if (info.valueQuantity == kokkos_value_set) {
+            buildSet(info.candidates.set);
+        } else if (info.valueQuantity == kokkos_value_range) {
+            buildRange(info.candidates.range);
+        }
+    }
+    Kind kind(void) const { return kind_; }
+    bool isSet(void) const { return kind_ == Kind::Set; }
+    Kokkos_Tools_VariableInfo_ValueType type(void) const { return type_; }
+    /* the value at an index as a number, 0 for strings */
+    double numericAt(size_t index) const {
+        if (type_ == kokkos_value_double) { return doubleAt(index); }
+        if (type_ == kokkos_value_int64) { return (double)intAt(index); }
+        return 0.0;
+    }
+    /* number of valid values, 0 for unbounded variables */
+    size_t size(void) const { return size_; }
+    void assign(union Kokkos_Tools_VariableValue_ValueUnion& value, size_t index) const {
+        if (type_ == kokkos_value_double) {
+            value.double_value = doubleAt(index);
+        } else if (type_ == kokkos_value_int64) {
+            value.int_value = intAt(index);
+        } else {
+            memcpy(value.string_value, strings_[index], KOKKOS_TOOLS_TUNING_STRING_LENGTH);
+        }
+    }
+    double doubleAt(size_t index) const {
+        if (kind_ == Kind::Set) { return doubles_[index]; }
+        return std::min(dlower_ + (double)index * dstep_, dupper_);
+    }
+    int64_t intAt(size_t index) const {
+        if (kind_ == Kind::Set) { return ints_[index]; }
+        return llower_ + (int64_t)index * lstep_;
+    }
+    /* The index of a value: exact match for sets (SIZE_MAX if it isn't one
+     * of the candidates), nearest level for ranges. */
+    size_t indexOf(const union Kokkos_Tools_VariableValue_ValueUnion& value) const {
+        if (size_ == 0) { return SIZE_MAX; }
+        if (kind_ == Kind::Set) {
+            for (size_t i = 0 ; i < size_ ; i++) {
+                if (type_ == kokkos_value_double) {
+                    if (doubles_[i] == value.double_value) { return i; }
+                } else if (type_ == kokkos_value_int64) {
+                    if (ints_[i] == value.int_value) { return i; }
+                } else if (strncmp(strings_[i], value.string_value,
+                                   KOKKOS_TOOLS_TUNING_STRING_LENGTH) == 0) {
+                    return i;
+                }
+            }
+            return SIZE_MAX;
+        }
+        double level;
+        if (type_ == kokkos_value_double) {
+            level = std::round((value.double_value - dlower_) / dstep_);
+        } else {
+            level = std::round((double)(value.int_value - llower_) / (double)lstep_);
+        }
+        level = std::min(std::max(level, 0.0), (double)(size_ - 1));
+        return (size_t)level;
+    }
+private:
+    Kind kind_;
+    Kokkos_Tools_VariableInfo_ValueType type_;
+    size_t size_;
+    std::vector<int64_t> ints_;
+    std::vector<double> doubles_;
+    std::vector<const char*> strings_;
+    double dlower_;
+    double dupper_;
+    double dstep_;
+    int64_t llower_;
+    int64_t lstep_;
+    void buildSet(const Kokkos_Tools_ValueSet& set) {
+        kind_ = Kind::Set;
+        size_ = set.size;
+        for (size_t i = 0 ; i < set.size ; i++) {
+            if (type_ == kokkos_value_double) {
+                doubles_.push_back(set.values.double_value[i]);
+            } else if (type_ == kokkos_value_int64) {
+                ints_.push_back(set.values.int_value[i]);
+            } else {
+                strings_.push_back(StringPool::get().intern(set.values.string_value[i]));
+            }
+        }
+    }
+    void buildRange(const Kokkos_Tools_ValueRange& range) {
+        kind_ = Kind::Range;
+        /*
+         * [] and () denote whether the range is inclusive/exclusive of the endpoint:
+         * [ includes the endpoint
+         * ( excludes the endpoint
+         * [] = 'Closed', includes both endpoints
+         * () = 'Open', excludes both endpoints
+         * [) and (] are both 'half-open', and include only one endpoint
+         */
+        if (type_ == kokkos_value_double) {
+            double lower = range.lower.double_value;
+            double upper = range.upper.double_value;
+            double step = range.step.double_value;
+            if (step <= 0.0) {
+                // no step, so pick one that gives us defaultLevels values
+                step = (upper - lower) / (double)(defaultLevels - 1);
+            }
+            if (range.openLower) { lower = lower + step; }
+            if (range.openUpper) { upper = upper - step; }
+            if (upper < lower || step <= 0.0) {
+                size_ = (upper == lower) ? 1 : 0;
+            } else {
+                size_ = (size_t)(std::floor((upper - lower) / step + 1e-9)) + 1;
+            }
+            dlower_ = lower;
+            dupper_ = upper;
+            dstep_ = step > 0.0 ? step : 1.0;
+        } else if (type_ == kokkos_value_int64) {
+            int64_t lower = range.lower.int_value;
+            int64_t upper = range.upper.int_value;
+            int64_t step = range.step.int_value > 0 ? range.step.int_value : 1;
+            if (range.openLower) { lower = lower + step; }
+            if (range.openUpper) { upper = upper - step; }
+            size_ = (upper < lower) ? 0 : (size_t)((upper - lower) / step) + 1;
+            llower_ = lower;
+            lstep_ = step;
+        }
+    }
+};
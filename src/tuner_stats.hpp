@@ -0,0 +1,123 @@
+#pragma once
+
+/* Measurement statistics for one configuration. A single timing on a busy
+ * node says little (one lucky sample can make a slow configuration look
+ * like the best), so the tuner keeps the most recent samples of every
+ * configuration it measures, and compares configurations on a robust
+ * estimate of their cost instead.
+ *
+ * Outliers are found with the median absolute deviation (MAD). Noise from
+ * the OS only ever makes things slower, so only samples far above the
+ * median are rejected.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <string>
+
+enum class Statistic { Median, TrimmedMean, Mean };
+
+inline Statistic parseStatistic(const std::string& name) {
+    if (name == "mean") { return Statistic::Mean; }
+    if (name == "trimmed-mean") { return Statistic::TrimmedMean; }
+    return Statistic::Median;
+}
+
+inline const char* pStatistic(Statistic s) {
+    if (s == Statistic::Mean) { return "mean"; }
+    if (s == Statistic::TrimmedMean) { return "trimmed mean"; }
+    return "median";
+}
+
+class SampleStats {
+public:
+    /* how many recent samples are kept */
+    static constexpr size_t window{16};
+    /* how many MADs above the median an outlier is */
+    static constexpr double outlierMADs{3.5};
+    SampleStats() : count_(0), outliers_(0), next_(0) { }
+    void add(double sample) {
+        if (isOutlier(sample)) { outliers_++; }
+        samples_[next_] = sample;
+        next_ = (next_ + 1) % window;
+        count_++;
+    }
+    /* every sample ever added, not just the ones in the window */
+    size_t count(void) const { return count_; }
+    size_t outliers(void) const { return outliers_; }
+    /* is this sample way slower than what we've seen so far? Needs a few
+     * samples before it will say yes. */
+    bool isOutlier(double sample) const {
+        double sorted[window];
+        size_t n = sortedSamples(sorted);
+        if (n < 5) { return false; }
+        double median = medianOf(sorted, n);
+        double mad = madOf(sorted, n, median);
+        return mad > 0.0 && (sample - median) > outlierMADs * mad;
+    }
+    /* the cost of this configuration, ignoring the outliers in the window */
+    double estimate(Statistic statistic) const {
+        double sorted[window];
+        size_t n = keptSamples(sorted);
+        if (n == 0) { return HUGE_VAL; }
+        if (statistic == Statistic::Median) { return medianOf(sorted, n); }
+        // the trimmed mean drops the fastest and slowest 20%
+        size_t trim = (statistic == Statistic::TrimmedMean) ? n / 5 : 0;
+        double sum{0.0};
+        for (size_t i = trim ; i < n - trim ; i++) { sum += sorted[i]; }
+        return sum / (double)(n - 2 * trim);
+    }
+    double mean(void) const {
+        double sorted[window];
+        size_t n = keptSamples(sorted);
+        double sum{0.0};
+        for (size_t i = 0 ; i < n ; i++) { sum += sorted[i]; }
+        return n == 0 ? 0.0 : sum / (double)n;
+    }
+    double stddev(void) const {
+        double sorted[window];
+        size_t n = keptSamples(sorted);
+        if (n < 2) { return 0.0; }
+        double m = mean();
+        double sum{0.0};
+        for (size_t i = 0 ; i < n ; i++) { sum += (sorted[i] - m) * (sorted[i] - m); }
+        return std::sqrt(sum / (double)(n - 1));
+    }
+    /* of the estimate, close enough for the median too */
+    double standardError(void) const {
+        size_t n = std::min(count_, window);
+        return n < 2 ? 0.0 : stddev() / std::sqrt((double)n);
+    }
+private:
+    double samples_[window];
+    size_t count_;
+    size_t outliers_;
+    size_t next_;
+    size_t sortedSamples(double* sorted) const {
+        size_t n = std::min(count_, window);
+        std::copy(samples_, samples_ + n, sorted);
+        std::sort(sorted, sorted + n);
+        return n;
+    }
+    /* the window, sorted, without the slow outliers */
+    size_t keptSamples(double* sorted) const {
+        size_t n = sortedSamples(sorted);
+        if (n < 5) { return n; }
+        double median = medianOf(sorted, n);
+        double mad = madOf(sorted, n, median);
+        if (mad <= 0.0) { return n; }
+        while (n > 0 && (sorted[n - 1] - median) > outlierMADs * mad) { n--; }
+        return n;
+    }
+    static double medianOf(const double* sorted, size_t n) {
+        return (n % 2 == 1) ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+    }
+    /* scaled so that it estimates the standard deviation of normal data */
+    static double madOf(const double* sorted, size_t n, double median) {
+        double deviations[window];
+        for (size_t i = 0 ; i < n ; i++) { deviations[i] = std::fabs(sorted[i] - median); }
+        std::sort(deviations, deviations + n);
+        return 1.4826 * medianOf(deviations, n);
+    }
+};
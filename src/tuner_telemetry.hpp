@@ -0,0 +1,229 @@
+#pragma once
+
+/* A stream of every finished context, for analyzing the trials offline
+ * (KOKKOS_TUNING_TELEMETRY). Unlike the trace, nothing is lost to a ring:
+ * rows go into one of two buffers, and a background thread writes the
+ * other one to the file, so the hooks only ever copy a row under a short
+ * lock and never wait for the disk. If the writer falls so far behind that
+ * both buffers are full, rows are dropped (and counted) rather than making
+ * the application wait.
+ *
+ * The file is a header and then a sequence of records, each starting with
+ * uint32_t kind and uint32_t bytes (the size of the whole record):
+ *
+ *   header:  char magic[8] = "KTTELEM1", uint32_t version, uint32_t rowSize
+ *   Search:  uint64_t signature, uint32_t numOutputs, string description,
+ *            then for every output uint32_t type (Kokkos value type),
+ *            string name, uint32_t numStrings and that many strings (the
+ *            candidates of string outputs), where a string is uint32_t
+ *            length and the characters
+ *   Row:     see below, always after the Search of its signature
+ *   Dropped: uint64_t count, at the end of the file
+ *
+ * tuner-telemetry-csv turns a file into one CSV per search.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TelemetryWriter {
+public:
+    static constexpr uint32_t version{1};
+    static constexpr size_t maxValues{8};
+    enum class Kind : uint32_t {
+        Search = 1,
+        Row = 2,
+        Dropped = 3
+    };
+    enum Flags : uint32_t {
+        Measured = 1,   // the search was given the cost
+        Exploit = 2,    // the best configuration, after the search stopped
+        Reported = 4,   // the cost is the objectives the application reported
+        Nested = 8      // the context had inner contexts
+    };
+    struct Row {
+        uint32_t kind;
+        uint32_t bytes;
+        uint64_t timestamp;   // ns since telemetry started, at the end of the context
+        uint64_t contextId;
+        uint64_t signature;
+        double cost;          // what the search was credited with
+        uint64_t duration;    // inclusive, in the units of the objective
+        uint32_t flags;
+        uint32_t thread;      // small per-thread number
+        uint32_t numValues;   // how many outputs the context had
+        uint32_t unused;
+        /* the bits of the values of the first outputs: int64, double, or
+         * the candidate index for strings */
+        uint64_t values[maxValues];
+    };
+    static_assert(sizeof(Row) == 128, "telemetry rows should be two cache lines");
+    /* Builds the variable length records. */
+    class Record {
+    public:
+        explicit Record(Kind kind) {
+            put((uint32_t)kind);
+            put((uint32_t)0);
+        }
+        template<typename T> void put(const T& value) {
+            const char* bytes = reinterpret_cast<const char*>(&value);
+            data_.insert(data_.end(), bytes, bytes + sizeof(T));
+        }
+        void put(const std::string& str) {
+            put((uint32_t)str.size());
+            data_.insert(data_.end(), str.begin(), str.end());
+        }
+        const std::vector<char>& finish(void) {
+            uint32_t bytes = (uint32_t)data_.size();
+            std::memcpy(data_.data() + sizeof(uint32_t), &bytes, sizeof(bytes));
+            return data_;
+        }
+    private:
+        std::vector<char> data_;
+    };
+    TelemetryWriter() : enabled_(false), stopping_(false), backFull_(false),
+        capacity_(0), fp_(nullptr), dropped_(0), written_(0), threads_(0) { }
+    ~TelemetryWriter() { stop(); }
+    /* Open the file and start the writer, with buffers of this many rows.
+     * Returns false if the file couldn't be opened. */
+    bool start(const std::string& path, size_t rows) {
+        fp_ = fopen(path.c_str(), "wb");
+        if (fp_ == nullptr) { return false; }
+        uint32_t rowSize = sizeof(Row);
+        fwrite("KTTELEM1", 8, 1, fp_);
+        fwrite(&version, sizeof(version), 1, fp_);
+        fwrite(&rowSize, sizeof(rowSize), 1, fp_);
+        capacity_ = (rows == 0 ? 1 : rows) * sizeof(Row);
+        front_.reserve(capacity_);
+        back_.reserve(capacity_);
+        epoch_ = std::chrono::steady_clock::now();
+        enabled_ = true;
+        thread_ = std::thread([this]() { run(); });
+        return true;
+    }
+    bool enabled(void) const { return enabled_; }
+    /* Write whatever is buffered and close the file. Only call this once
+     * the hooks have stopped. Returns the number of rows written. */
+    size_t stop(void) {
+        if (!enabled_) { return 0; }
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+        Record dropped(Kind::Dropped);
+        dropped.put(dropped_);
+        const std::vector<char>& data = dropped.finish();
+        fwrite(data.data(), data.size(), 1, fp_);
+        fclose(fp_);
+        fp_ = nullptr;
+        enabled_ = false;
+        return written_;
+    }
+    /* Describe a search, before any of its rows. These are never dropped. */
+    void describe(Record& record) {
+        if (!enabled_) { return; }
+        const std::vector<char>& data = record.finish();
+        std::lock_guard<std::mutex> guard(mutex_);
+        schemas_.insert(schemas_.end(), data.begin(), data.end());
+    }
+    /* Fill in the rest of a row (kind, size, timestamp and thread) and
+     * queue it. */
+    void record(Row& row) {
+        if (!enabled_) { return; }
+        row.kind = (uint32_t)Kind::Row;
+        row.bytes = sizeof(Row);
+        row.timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch_).count();
+        row.thread = threadNumber();
+        row.unused = 0;
+        const char* bytes = reinterpret_cast<const char*>(&row);
+        bool wake{false};
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (front_.size() + sizeof(Row) > capacity_) {
+                if (backFull_) {
+                    // the writer is still busy with the other buffer
+                    dropped_++;
+                    return;
+                }
+                front_.swap(back_);
+                backFull_ = true;
+                wake = true;
+            }
+            front_.insert(front_.end(), bytes, bytes + sizeof(Row));
+        }
+        if (wake) { wake_.notify_one(); }
+    }
+    uint64_t dropped(void) const { return dropped_; }
+private:
+    /* how often a partly full buffer is written anyway, so the file keeps
+     * up with a long run */
+    static constexpr std::chrono::milliseconds flushInterval{100};
+    bool enabled_;
+    bool stopping_;
+    /* back_ belongs to the writer thread while this is set */
+    bool backFull_;
+    size_t capacity_;
+    FILE* fp_;
+    uint64_t dropped_;
+    size_t written_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<char> front_;
+    std::vector<char> back_;
+    std::vector<char> schemas_;
+    std::thread thread_;
+    std::atomic<uint32_t> threads_;
+    std::chrono::steady_clock::time_point epoch_;
+    void run(void) {
+        std::vector<char> schemas;
+        for (;;) {
+            bool stopping;
+            bool full;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait_for(lock, flushInterval,
+                    [this]() { return backFull_ || stopping_; });
+                stopping = stopping_;
+                if (!backFull_ && !front_.empty()) {
+                    front_.swap(back_);
+                    backFull_ = true;
+                }
+                full = backFull_;
+                // the searches of the rows we are about to write come first
+                schemas.swap(schemas_);
+            }
+            if (!schemas.empty()) {
+                fwrite(schemas.data(), schemas.size(), 1, fp_);
+                schemas.clear();
+            }
+            bool more{false};
+            if (full) {
+                fwrite(back_.data(), back_.size(), 1, fp_);
+                written_ += back_.size() / sizeof(Row);
+                back_.clear();
+                std::lock_guard<std::mutex> guard(mutex_);
+                backFull_ = false;
+                // when stopping, the front buffer may still have rows
+                more = !front_.empty();
+            }
+            fflush(fp_);
+            if (stopping && !more) { break; }
+        }
+    }
+    uint32_t threadNumber(void) {
+        static thread_local uint32_t number{threads_.fetch_add(1, std::memory_order_relaxed)};
+        return number;
+    }
+};
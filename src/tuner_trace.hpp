@@ -0,0 +1,105 @@
+#pragma once
+
+/* A binary trace of the tuner hooks, for seeing what the tuner did under
+ * load without the cost of logging. Events go into a fixed size ring (the
+ * newest ones win), and the ring is written to a file at finalize:
+ *
+ *   header:  char magic[8] = "KTTRACE1", uint32_t version,
+ *            uint32_t eventSize, uint64_t count, uint64_t dropped
+ *   events:  count Events, oldest first
+ *
+ * Recording an event is one atomic increment and a 64 byte store. Slots are
+ * claimed with the increment, so two threads only ever write the same slot
+ * if one of them is a whole ring behind the other.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class TraceRing {
+public:
+    static constexpr uint32_t version{1};
+    static constexpr size_t maxIndices{6};
+    enum class Kind : uint16_t {
+        Begin = 1,    // begin_context
+        Request = 2,  // request_values, handing out a configuration to try
+        Exploit = 3,  // request_values, handing out the best configuration
+        End = 4       // end_context, value is the duration in ns (0 if not measured)
+    };
+    struct Event {
+        uint64_t timestamp;   // ns since the trace was enabled
+        uint64_t contextId;
+        uint64_t signature;   // of the search, 0 for Begin
+        uint64_t value;
+        uint16_t kind;
+        uint16_t numIndices;  // how many outputs the request had
+        uint32_t thread;      // small per-thread number
+        uint32_t indices[maxIndices];  // candidate indices of the first outputs
+    };
+    static_assert(sizeof(Event) == 64, "trace events should be one cache line");
+    TraceRing() : enabled_(false), mask_(0), head_(0), threads_(0) { }
+    /* capacity is rounded up to a power of two */
+    void enable(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) { size = size << 1; }
+        events_.resize(size);
+        mask_ = size - 1;
+        epoch_ = std::chrono::steady_clock::now();
+        enabled_ = true;
+    }
+    bool enabled(void) const { return enabled_; }
+    void record(Kind kind, uint64_t contextId, uint64_t signature,
+        uint64_t value = 0, const size_t* indices = nullptr, size_t numIndices = 0) {
+        if (!enabled_) { return; }
+        Event& event = events_[head_.fetch_add(1, std::memory_order_relaxed) & mask_];
+        event.timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch_).count();
+        event.contextId = contextId;
+        event.signature = signature;
+        event.value = value;
+        event.kind = (uint16_t)kind;
+        event.numIndices = (uint16_t)numIndices;
+        event.thread = threadNumber();
+        for (size_t i = 0 ; i < maxIndices ; i++) {
+            event.indices[i] = (i < numIndices && indices[i] != SIZE_MAX) ?
+                (uint32_t)indices[i] : UINT32_MAX;
+        }
+    }
+    /* Write the ring out, oldest event first. Only call this once the hooks
+     * have stopped. Returns the number of events written. */
+    size_t dump(const std::string& path) const {
+        if (!enabled_) { return 0; }
+        FILE* fp = fopen(path.c_str(), "wb");
+        if (fp == nullptr) { return 0; }
+        uint64_t head = head_.load();
+        uint64_t count = head < events_.size() ? head : events_.size();
+        uint64_t dropped = head - count;
+        uint32_t eventSize = sizeof(Event);
+        bool ok = fwrite("KTTRACE1", 8, 1, fp) == 1 &&
+                  fwrite(&version, sizeof(version), 1, fp) == 1 &&
+                  fwrite(&eventSize, sizeof(eventSize), 1, fp) == 1 &&
+                  fwrite(&count, sizeof(count), 1, fp) == 1 &&
+                  fwrite(&dropped, sizeof(dropped), 1, fp) == 1;
+        for (uint64_t i = dropped ; ok && i < head ; i++) {
+            ok = fwrite(&events_[i & mask_], sizeof(Event), 1, fp) == 1;
+        }
+        fclose(fp);
+        return ok ? count : 0;
+    }
+private:
+    bool enabled_;
+    size_t mask_;
+    std::vector<Event> events_;
+    std::atomic<uint64_t> head_;
+    std::atomic<uint32_t> threads_;
+    std::chrono::steady_clock::time_point epoch_;
+    uint32_t threadNumber(void) {
+        static thread_local uint32_t number{threads_.fetch_add(1, std::memory_order_relaxed)};
+        return number;
+    }
+};
@@ -2,8 +2,23 @@
 
 #include<Kokkos_Core.hpp>
 #include<unordered_map>
+#include<map>
+#include<array>
+#include<tuple>
+#include<utility>
+#include<atomic>
+#include<condition_variable>
+#include<functional>
+#include<mutex>
+#include<thread>
+#include<algorithm>
 #include<iostream>
+#include<cstdlib>
+#include<cstring>
+#include<vector>
 #include<Kokkos_Profiling_ScopedRegion.hpp>
+#include<dlfcn.h>
+#include "tuner_random.hpp"
 
 namespace Impl {
 
@@ -40,6 +55,29 @@ auto setup_helper(const Setup &setup, int num_iters, std::true_type) {
 
 } // namespace Impl
 
+/* sizesFromArguments - the sizes given on the command line, or the defaults
+   if there aren't any. Call it before tuned_kernel (which hands the
+   arguments to Kokkos::initialize), and it skips the --kokkos ones. Says
+   what is wrong and returns false if an argument isn't a positive size.
+   */
+bool sizesFromArguments(int argc, char* argv[], const std::vector<int64_t>& defaults,
+    std::vector<int64_t>& sizes){
+  sizes.clear();
+  for (int i = 1 ; i < argc ; i++) {
+    if (std::strncmp(argv[i], "--kokkos", 8) == 0) { continue; }
+    char* end = nullptr;
+    long long size = std::strtoll(argv[i], &end, 10);
+    if (end == argv[i] || *end != '\0' || size <= 0) {
+      std::cerr << argv[0] << ": a size has to be a positive integer, not '"
+                << argv[i] << "'" << std::endl;
+      return false;
+    }
+    sizes.push_back(int64_t(size));
+  }
+  if (sizes.empty()) { sizes = defaults; }
+  return true;
+}
+
 template<typename Setup, typename Tunable>
 void tuned_kernel(int argc, char* argv[], Setup setup, Tunable tunable){
   int num_iters = 1000;
@@ -66,7 +104,13 @@ void fastest_of_helper(int index, Head head, Cons... cons){
   return fastest_of_helper(index-1, cons...);
 }
 
-static std::unordered_map<std::string, size_t> ids_for_kernels;
+/* the output variable of each fastest_of() label, and where its fallback
+   round robin is */
+struct fastest_of_state {
+  size_t id;
+  size_t next;
+};
+static std::unordered_map<std::string, fastest_of_state> ids_for_kernels;
 size_t create_categorical_int_tuner(std::string name, size_t num_options){
   using namespace Kokkos::Tools::Experimental;
   VariableInfo info;
@@ -106,44 +150,269 @@ void fastest_of(const std::string& label, const size_t count, Implementations...
     auto tuner_iter = [&]() {
       auto my_tuner = ids_for_kernels.find(label);
       if (my_tuner == ids_for_kernels.end()) {
-        return (ids_for_kernels.emplace(label, create_categorical_int_tuner(label, sizeof...(Implementations)))
-                    .first);
+        fastest_of_state state{create_categorical_int_tuner(label, sizeof...(Implementations)), 0};
+        return ids_for_kernels.emplace(label, state).first;
       }
       return my_tuner;
     }();
-    auto var_id = tuner_iter->second;
+    auto var_id = tuner_iter->second.id;
     auto input_id = create_fastest_implementation_id(count);
     VariableValue picked_implementation = make_variable_value(input_id,int64_t(0));
-    VariableValue which_kernel = make_variable_value(var_id,label.c_str());
-    which_kernel.value.int_value = -1;
+    VariableValue which_kernel = make_variable_value(var_id,int64_t(-1));
     auto context_id = get_new_context_id();
     begin_context(context_id);
     set_input_values(context_id, 1, &picked_implementation);
     request_output_values(context_id, 1, &which_kernel);
     // if we didn't get a prediction, just alternate between methods.
     if (which_kernel.value.int_value < 0) {
-        static int flipper{0};
-        fastest_of_helper(flipper, implementations...);
-        flipper = (flipper + 1) % count;
+        size_t& next = tuner_iter->second.next;
+        fastest_of_helper(next, implementations...);
+        next = (next + 1) % count;
     } else {
         fastest_of_helper(which_kernel.value.int_value, implementations...);
     }
     end_context(context_id);
 }
 
+/* FastestOf - fastest_of() as an object, for calling in a hot loop. It
+   declares its variable once, keeps the values of its context, and picks the
+   implementation through a table of function pointers made at compile time,
+   so a call is the tuner's round trip and an indirect call:
+     FastestOf smoother("meta-smoother", [&]() { ... }, [&]() { ... });
+     for (...) { smoother(); }
+   Arguments of the call are passed on to the implementation. It can be
+   called from several threads at once (see BatchedTrials). Without a
+   prediction from the tool, each instance takes turns on its own.
+   */
+template<typename... Implementations>
+class FastestOf {
+public:
+  static constexpr size_t count{sizeof...(Implementations)};
+  static_assert(count > 0, "FastestOf needs at least one implementation");
+  explicit FastestOf(const std::string& label, Implementations... implementations) :
+    implementations_(std::move(implementations)...) {
+    using namespace Kokkos::Tools::Experimental;
+    input_ = make_variable_value(create_fastest_implementation_id(count), int64_t(0));
+    output_ = make_variable_value(create_categorical_int_tuner(label, count), int64_t(-1));
+  }
+  /* run the implementation the tuner picks, in its own context */
+  template<typename... Args>
+  void operator()(Args&&... args) {
+    using namespace Kokkos::Tools::Experimental;
+    VariableValue input{input_};
+    VariableValue picked{output_};
+    auto context_id = get_new_context_id();
+    begin_context(context_id);
+    set_input_values(context_id, 1, &input);
+    request_output_values(context_id, 1, &picked);
+    size_t index;
+    if (picked.value.int_value < 0 || picked.value.int_value >= (int64_t)count) {
+      // no prediction, so take turns
+      index = next_.fetch_add(1, std::memory_order_relaxed) % count;
+    } else {
+      index = (size_t)picked.value.int_value;
+    }
+    table<Args...>[index](implementations_, std::forward<Args>(args)...);
+    end_context(context_id);
+  }
+private:
+  using Tuple = std::tuple<Implementations...>;
+  template<typename... Args>
+  using Table = std::array<void (*)(Tuple&, Args&&...), count>;
+  template<size_t Index, typename... Args>
+  static void invoke(Tuple& implementations, Args&&... args) {
+    std::get<Index>(implementations)(std::forward<Args>(args)...);
+  }
+  template<typename... Args, size_t... Indices>
+  static constexpr Table<Args...> makeTable(std::index_sequence<Indices...>) {
+    return Table<Args...>{{&invoke<Indices, Args...>...}};
+  }
+  /* one table for every way the handle is called */
+  template<typename... Args>
+  static constexpr Table<Args...> table{makeTable<Args...>(std::make_index_sequence<count>{})};
+  Tuple implementations_;
+  Kokkos::Tools::Experimental::VariableValue input_;
+  Kokkos::Tools::Experimental::VariableValue output_;
+  std::atomic<size_t> next_{0};
+};
+
+/* BatchedTrials - run several trials of a tuned region at the same time,
+   each on its own partition of the default execution space, for when one
+   trial doesn't fill the device:
+     BatchedTrials batch(4);
+     for (...) {
+       batch([&](const Kokkos::DefaultExecutionSpace& space, size_t slot) { ... });
+     }
+   Every trial runs on a host thread of its own (so partitions of a host
+   backend run side by side too), the trials start together, and each one
+   should fence its space before it ends its context so that it is timed on
+   its own. Slot 0 is the calling thread, and the other slots have threads
+   that are started with the batch object and wait between batches, so a
+   slot is on the same thread (with the same per-thread tuner state) for as
+   long as the object lives. Contexts of one search that are open at the
+   same time get different configurations where the search can (different
+   bandit arms, different random values). A batch of one runs the trial on
+   the calling thread and the default instance. The simple tuner's fence is
+   for the whole device, so it doesn't fence while a wider batch runs.
+   */
+class BatchedTrials {
+public:
+  explicit BatchedTrials(size_t width) {
+    using Kokkos::DefaultExecutionSpace;
+    // every partition needs at least one thread
+    width = std::min<size_t>(std::max<size_t>(width, 1), DefaultExecutionSpace().concurrency());
+    if (width <= 1) {
+      instances_.push_back(DefaultExecutionSpace());
+    } else {
+      instances_ = Kokkos::Experimental::partition_space(DefaultExecutionSpace(),
+          std::vector<int>(width, 1));
+    }
+    for (size_t slot = 1 ; slot < instances_.size() ; slot++) {
+      workers_.emplace_back([this, slot]() { work(slot); });
+    }
+  }
+  BatchedTrials(const BatchedTrials&) = delete;
+  BatchedTrials& operator=(const BatchedTrials&) = delete;
+  ~BatchedTrials() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stopping_ = true;
+      generation_++;
+    }
+    start_.notify_all();
+    for (auto& worker : workers_) { worker.join(); }
+  }
+  size_t width(void) const { return instances_.size(); }
+  const Kokkos::DefaultExecutionSpace& instance(size_t slot) const { return instances_[slot]; }
+  /* run trial(space, slot) once on every partition, and wait for all of them */
+  template<typename Trial>
+  void operator()(Trial&& trial) {
+    if (instances_.size() == 1) {
+      trial(instances_[0], size_t(0));
+      return;
+    }
+    tellTuner(1);
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      task_ = [&](size_t slot) { trial(instances_[slot], slot); };
+      waiting_.store(instances_.size());
+      running_ = workers_.size();
+      generation_++;
+    }
+    start_.notify_all();
+    run(0);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_.wait(lock, [this]() { return running_ == 0; });
+      task_ = nullptr;
+    }
+    tellTuner(0);
+  }
+private:
+  std::vector<Kokkos::DefaultExecutionSpace> instances_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  /* the trial of the current batch, and how many workers are still on it */
+  std::function<void(size_t)> task_;
+  size_t running_{0};
+  /* one more for every batch, so a worker knows when there's a new one */
+  size_t generation_{0};
+  bool stopping_{false};
+  /* slots that haven't got to the start line of this batch */
+  std::atomic<size_t> waiting_{0};
+  /* wait for every slot, so the trials start together, then run one */
+  void run(size_t slot) {
+    waiting_.fetch_sub(1);
+    while (waiting_.load() > 0) { std::this_thread::yield(); }
+    task_(slot);
+  }
+  void work(size_t slot) {
+    size_t seen{0};
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&]() { return generation_ != seen; });
+        seen = generation_;
+        if (stopping_) { return; }
+      }
+      run(slot);
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (--running_ == 0) { done_.notify_one(); }
+    }
+  }
+  /* a batch is running (1) or done (0), if the tool is the simple tuner */
+  static void tellTuner(int running) {
+    using batch_t = void (*)(int);
+    static batch_t batch = reinterpret_cast<batch_t>(
+        dlsym(RTLD_DEFAULT, "simple_tuner_batch"));
+    if (batch != nullptr) {
+      batch(running);
+    }
+  }
+};
+
+/* reportObjective - tell the tuner how a context went, before ending it.
+   When anything is reported for a context, the tuner minimizes the weighted
+   sum of the reported values (see KOKKOS_TUNING_OBJECTIVE_WEIGHTS) instead of
+   the measured time, e.g. reportObjective(context, "iterations", iters).
+   Does nothing if the loaded tool isn't the simple tuner.
+   */
+void reportObjective(size_t context, const std::string& name, double value){
+  using report_t = void (*)(size_t, const char*, double);
+  static report_t report = reinterpret_cast<report_t>(
+      dlsym(RTLD_DEFAULT, "simple_tuner_report_objective"));
+  if (report != nullptr) {
+    report(context, name.c_str(), value);
+  }
+}
+
+/* constrainProduct - keep the product of some output variables at most a
+   bound, e.g. the tile sizes of an MDRange against the most threads a team
+   can have, or a thread count against the cores. constrain() takes a
+   predicate instead, which gets the values of the variables in order and
+   returns non-zero if they are a valid combination. Both are respected by
+   every search that has all of the variables as outputs, so call them after
+   declaring the variables and before the first context that uses them.
+   They do nothing if the loaded tool isn't the simple tuner.
+   */
+void constrainProduct(const std::vector<size_t>& ids, double bound){
+  using constrain_t = void (*)(size_t, const size_t*, double);
+  static constrain_t hook = reinterpret_cast<constrain_t>(
+      dlsym(RTLD_DEFAULT, "simple_tuner_constrain_product"));
+  if (hook != nullptr) {
+    hook(ids.size(), ids.data(), bound);
+  }
+}
+
+using valid_t = int (*)(size_t, const Kokkos::Tools::Experimental::VariableValue*, void*);
+void constrain(const std::vector<size_t>& ids, valid_t valid, void* data = nullptr){
+  using constrain_t = void (*)(size_t, const size_t*, valid_t, void*);
+  static constrain_t hook = reinterpret_cast<constrain_t>(
+      dlsym(RTLD_DEFAULT, "simple_tuner_constrain"));
+  if (hook != nullptr) {
+    hook(ids.size(), ids.data(), valid, data);
+  }
+}
+
 enum schedulers{StaticSchedule, DynamicSchedule};
 static const std::string scheduleNames[] = {"static", "dynamic"};
 constexpr int lowerBound{100};
 constexpr int upperBound{999};
 
-// Helper function to generate tile sizes
+// Helper function to generate tile sizes: the factors come in pairs around
+// the square root, so only look that far
 std::vector<int64_t> factorsOf(const int &size){
     std::vector<int64_t> factors;
-    for(int i=1; i<=size; i++){
+    std::vector<int64_t> large;
+    for(int64_t i=1; i*i<=size; i++){
         if(size % i == 0){
             factors.push_back(i);
+            if(i != size / i){ large.push_back(size / i); }
         }
     }
+    factors.insert(factors.end(), large.rbegin(), large.rend());
     return factors;
 }
 
@@ -238,7 +507,7 @@ size_t declareOutputSchedules(std::string varname) {
 size_t declareOutputThreadCount(std::string varname, size_t limit) {
     size_t out_value_id;
     // create a vector of potential values
-    std::vector<int64_t> candidates = makeRange<int64_t>(2, limit, 2);
+    std::vector<int64_t> candidates = makeRange<int64_t>(2, std::max<size_t>(limit, 2), 2);
     // create our variable object
     Kokkos::Tools::Experimental::VariableInfo out_info;
     // set the variable details
@@ -252,6 +521,45 @@ size_t declareOutputThreadCount(std::string varname, size_t limit) {
     return out_value_id;
 }
 
+// helper function for running with a tuned thread count: an instance of the
+// default execution space for every candidate of declareOutputThreadCount,
+// partitioned off the whole space. The instances have to be destroyed before
+// Kokkos::finalize().
+std::map<int64_t, Kokkos::DefaultExecutionSpace> threadCountInstances(size_t limit) {
+    std::map<int64_t, Kokkos::DefaultExecutionSpace> instances;
+    const int64_t all = Kokkos::DefaultExecutionSpace().concurrency();
+    for (int64_t threads : makeRange<int64_t>(2, std::max<size_t>(limit, 2), 2)) {
+        if (threads >= all) {
+            instances[threads] = Kokkos::DefaultExecutionSpace();
+        } else {
+            std::vector<int> weights{(int)threads, (int)(all - threads)};
+            instances[threads] = Kokkos::Experimental::partition_space(
+                Kokkos::DefaultExecutionSpace(), weights)[0];
+        }
+    }
+    return instances;
+}
+
+// helper function for launching an MDRange kernel with a tuned schedule and
+// tile sizes, on the given instance
+template<unsigned N, typename Functor>
+void parallelForTiled(const std::string& name, const Kokkos::DefaultExecutionSpace& space,
+        int64_t schedule, const Kokkos::Array<int64_t, N>& lower,
+        const Kokkos::Array<int64_t, N>& upper, const Kokkos::Array<int64_t, N>& tiles,
+        const Functor& functor) {
+    if (schedule == DynamicSchedule) {
+        Kokkos::parallel_for(name,
+            Kokkos::MDRangePolicy<Kokkos::DefaultExecutionSpace,
+                Kokkos::Schedule<Kokkos::Dynamic>, Kokkos::Rank<N>>
+                (space, lower, upper, tiles), functor);
+    } else {
+        Kokkos::parallel_for(name,
+            Kokkos::MDRangePolicy<Kokkos::DefaultExecutionSpace,
+                Kokkos::Schedule<Kokkos::Static>, Kokkos::Rank<N>>
+                (space, lower, upper, tiles), functor);
+    }
+}
+
 /*
 // helper function for declaring scheduler variable
 size_t declareOutputSchedules(std::string varname) {
@@ -344,10 +652,17 @@ size_t declareOutputRange(const std::string varname,
     return 0;
 }
 
+// the same data on every run, unless KOKKOS_TUNING_SEED says otherwise
+Xoshiro256& playgroundRandom(void) {
+    static Xoshiro256 generator{getenv("KOKKOS_TUNING_SEED") == nullptr ?
+        Xoshiro256::defaultSeed : strtoull(getenv("KOKKOS_TUNING_SEED"), nullptr, 0)};
+    return generator;
+}
+
 // helper function for matrix init
 void initArray(Kokkos::View<double *, Kokkos::HostSpace>& ar, size_t d1) {
     for(size_t i=0; i<d1; i++){
-        ar(i)=(rand() % (upperBound - lowerBound + 1)) + lowerBound;
+        ar(i)=playgroundRandom().below(upperBound - lowerBound + 1) + lowerBound;
     }
 }
 
@@ -355,7 +670,7 @@ void initArray(Kokkos::View<double *, Kokkos::HostSpace>& ar, size_t d1) {
 void initArray(Kokkos::View<double **, Kokkos::HostSpace>& ar, size_t d1, size_t d2) {
     for(size_t i=0; i<d1; i++){
         for(size_t j=0; j<d2; j++){
-            ar(i,j)=(rand() % (upperBound - lowerBound + 1)) + lowerBound;
+            ar(i,j)=playgroundRandom().below(upperBound - lowerBound + 1) + lowerBound;
         }
     }
 }
@@ -364,7 +679,7 @@ void initArray(Kokkos::View<double **, Kokkos::HostSpace>& ar, size_t d1, size_t
 void initArray(Kokkos::View<int **, Kokkos::HostSpace>& ar, size_t d1, size_t d2) {
     for(size_t i=0; i<d1; i++){
         for(size_t j=0; j<d2; j++){
-            ar(i,j)=(rand() % (upperBound - lowerBound + 1)) + lowerBound;
+            ar(i,j)=playgroundRandom().below(upperBound - lowerBound + 1) + lowerBound;
         }
     }
 }